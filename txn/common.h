@@ -12,6 +12,8 @@
 #include <string>
 #include <utility>
 
+#include "utils/flat_map.h"
+
 using std::string;
 
 // debug mode
@@ -43,6 +45,12 @@ typedef uint64_t uint64;
 typedef uint64 Key;
 typedef uint64 Value;
 
+// Key sets and per-key buffers of txns. Txns touch few keys, so these are
+// sorted flat arrays that only allocate beyond 32 elements.
+typedef FlatSet<Key, 32> KeySet;
+typedef FlatMap<Key, Value, 32> KeyValueMap;
+typedef FlatMap<Key, uint64, 32> KeyVersionMap;
+
 // Returns the number of seconds since midnight according to local system time,
 // to the nearest microsecond.
 static inline double GetTime() {
@@ -0,0 +1,116 @@
+
+#include "txn/contention_manager.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+#include "txn/txn.h"
+
+// Upper bound (in seconds) of the backoff delay after a txn's first restart.
+// The bound doubles with every further restart.
+#define CM_BACKOFF_BASE 0.00005
+
+// Number of restarts after which a txn is escalated.
+#define CM_ESCALATE_RESTARTS 8
+
+// Number of outcomes (commits plus restarts) per cap adjustment window, the
+// restart rates above/below which the cap is halved/grown, and the additive
+// growth step.
+#define CM_WINDOW_OUTCOMES 64
+#define CM_HIGH_RESTART_RATE 0.3
+#define CM_LOW_RESTART_RATE 0.1
+#define CM_CAP_INCREASE 4
+
+ContentionManager::ContentionManager(int min_in_flight, int max_in_flight)
+    : min_in_flight_(min_in_flight), max_in_flight_(max_in_flight),
+      cap_(max_in_flight), window_commits_(0), window_restarts_(0),
+      escalated_in_flight_(0), seed_(1)
+{
+}
+
+bool ContentionManager::Escalated(int restarts)
+{
+  return restarts >= CM_ESCALATE_RESTARTS;
+}
+
+void ContentionManager::TxnFinished(Txn *txn)
+{
+  if (Escalated(txn->restarts_))
+    escalated_in_flight_--;
+  window_commits_++;
+}
+
+void ContentionManager::TxnRestarted(Txn *txn)
+{
+  // The txn was escalated when it was admitted iff it was before this restart.
+  if (Escalated(txn->restarts_ - 1))
+    escalated_in_flight_--;
+  window_restarts_++;
+
+  Delayed d;
+  d.retry_time_ = GetTime();
+  d.txn_ = txn;
+  restarted_.Push(d);
+}
+
+double ContentionManager::Backoff(int restarts)
+{
+  double bound = CM_BACKOFF_BASE * (1 << std::min(restarts - 1, CM_ESCALATE_RESTARTS));
+  return bound * rand_r(&seed_) / RAND_MAX;
+}
+
+void ContentionManager::Update()
+{
+  Delayed d;
+  while (restarted_.Pop(&d))
+  {
+    if (Escalated(d.txn_->restarts_))
+    {
+      escalated_.push_back(d.txn_);
+    }
+    else
+    {
+      d.retry_time_ += Backoff(d.txn_->restarts_);
+      delayed_.push(d);
+    }
+  }
+
+  int commits = window_commits_;
+  int restarts = window_restarts_;
+  if (commits + restarts >= CM_WINDOW_OUTCOMES)
+  {
+    window_commits_ -= commits;
+    window_restarts_ -= restarts;
+    double restart_rate = static_cast<double>(restarts) / (commits + restarts);
+    if (restart_rate > CM_HIGH_RESTART_RATE)
+      cap_ = std::max(min_in_flight_, cap_ / 2);
+    else if (restart_rate < CM_LOW_RESTART_RATE)
+      cap_ = std::min(max_in_flight_, cap_ + CM_CAP_INCREASE);
+  }
+}
+
+bool ContentionManager::NextTxn(AtomicQueue<Txn *> *requests, int in_flight, Txn **txn)
+{
+  Update();
+
+  if (!escalated_.empty())
+  {
+    *txn = escalated_.front();
+    escalated_.pop_front();
+    escalated_in_flight_++;
+    return true;
+  }
+
+  // Let escalated txns run against as little competition as possible.
+  if (escalated_in_flight_ > 0 || in_flight >= cap_)
+    return false;
+
+  if (!delayed_.empty() && delayed_.top().retry_time_ <= GetTime())
+  {
+    *txn = delayed_.top().txn_;
+    delayed_.pop();
+    return true;
+  }
+
+  return requests->Pop(txn);
+}
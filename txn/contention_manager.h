@@ -0,0 +1,108 @@
+// Contention manager for the restart-based (OCC and MVCC) modes.
+
+#ifndef _CONTENTION_MANAGER_H_
+#define _CONTENTION_MANAGER_H_
+
+#include <atomic>
+#include <deque>
+#include <queue>
+#include <vector>
+
+#include "txn/common.h"
+#include "utils/atomic.h"
+
+using std::deque;
+using std::priority_queue;
+using std::vector;
+
+class Txn;
+
+// Decides when restarted txns are retried and how many txns may execute at
+// once. Three mechanisms keep the optimistic modes from livelocking under
+// contention:
+//
+//   - A restarted txn waits a random backoff delay before it is admitted
+//     again. The delay bound doubles with every restart of the txn.
+//   - The number of concurrently executing txns is capped. The cap is cut in
+//     half whenever the restart rate over the last window of outcomes is high,
+//     and grows additively while it is low (AIMD).
+//   - A txn that keeps restarting is escalated: it skips the backoff and the
+//     cap, and while it executes no other txns are admitted, so it only
+//     competes with the txns that were already running.
+//
+// TxnFinished and TxnRestarted may be called from any thread. NextTxn must
+// only be called from the (single) scheduler thread.
+class ContentionManager {
+ public:
+  // The in-flight cap starts at 'max_in_flight' and never drops below
+  // 'min_in_flight'.
+  ContentionManager(int min_in_flight, int max_in_flight);
+  ~ContentionManager() {}
+
+  // Records that an admitted txn has committed or aborted for good.
+  void TxnFinished(Txn* txn);
+
+  // Records that an admitted txn was restarted, and takes it over until its
+  // backoff delay has passed.
+  //
+  // Requires: txn->restarts_ already counts this restart.
+  void TxnRestarted(Txn* txn);
+
+  // Sets '*txn' to the next txn to admit and returns true, or returns false if
+  // nothing may be admitted right now. Escalated txns come first, then
+  // restarted txns whose backoff delay has passed, then new requests from
+  // 'requests'. 'in_flight' is the number of admitted txns that have not yet
+  // finished or restarted.
+  bool NextTxn(AtomicQueue<Txn*>* requests, int in_flight, Txn** txn);
+
+  // Returns the current cap on concurrently executing txns.
+  int Cap() { return cap_; }
+
+  // Returns true if a txn that has been restarted 'restarts' times is
+  // escalated.
+  static bool Escalated(int restarts);
+
+ private:
+  // A restarted txn waiting for its backoff delay to pass.
+  struct Delayed {
+    double retry_time_;
+    Txn* txn_;
+    bool operator<(const Delayed& other) const {
+      // priority_queue is a max-heap; put the earliest retry time on top.
+      return retry_time_ > other.retry_time_;
+    }
+  };
+
+  // Returns a random backoff delay (in seconds) for a txn that has been
+  // restarted 'restarts' times.
+  double Backoff(int restarts);
+
+  // Moves newly restarted txns into 'escalated_' or 'delayed_', and adjusts
+  // the cap if a full window of outcomes has been seen.
+  void Update();
+
+  int min_in_flight_;
+  int max_in_flight_;
+  int cap_;
+
+  // Outcomes in the current window. Incremented by any thread, reset by the
+  // scheduler thread.
+  std::atomic<int> window_commits_;
+  std::atomic<int> window_restarts_;
+
+  // Number of admitted escalated txns that have not finished or restarted.
+  std::atomic<int> escalated_in_flight_;
+
+  // Txns restarted since the last Update(), with the time of the restart.
+  AtomicQueue<Delayed> restarted_;
+
+  // Scheduler-thread only: escalated txns waiting to be admitted, and the
+  // other restarted txns ordered by the time they may be retried.
+  deque<Txn*> escalated_;
+  priority_queue<Delayed> delayed_;
+
+  // Seed for rand_r.
+  unsigned int seed_;
+};
+
+#endif  // _CONTENTION_MANAGER_H_
@@ -0,0 +1,78 @@
+
+#include "txn/contention_manager.h"
+
+#include <unistd.h>
+
+#include "txn/txn_types.h"
+#include "utils/testing.h"
+
+// Noop txn whose restart count can be set by the test.
+class RestartedNoop : public Noop {
+ public:
+  void SetRestarts(int restarts) { restarts_ = restarts; }
+};
+
+TEST(ContentionManager_BackoffAndEscalation) {
+  ContentionManager cm(1, 4);
+  AtomicQueue<Txn*> requests;
+  RestartedNoop t1, t2, t3;
+  Txn* txn;
+
+  // New requests are admitted up to the cap.
+  requests.Push(&t1);
+  EXPECT_TRUE(cm.NextTxn(&requests, 0, &txn));
+  EXPECT_EQ(&t1, txn);
+  requests.Push(&t3);
+  EXPECT_FALSE(cm.NextTxn(&requests, 4, &txn));
+
+  // Txn 1 restarts. It is admitted again once its backoff has passed, ahead of
+  // the pending request.
+  t1.SetRestarts(1);
+  cm.TxnRestarted(&t1);
+  usleep(1000);
+  EXPECT_TRUE(cm.NextTxn(&requests, 0, &txn));
+  EXPECT_EQ(&t1, txn);
+
+  // Txn 2 has restarted often enough to be escalated: it skips the cap, and
+  // nothing else is admitted while it runs.
+  t2.SetRestarts(8);
+  cm.TxnRestarted(&t2);
+  EXPECT_TRUE(cm.NextTxn(&requests, 4, &txn));
+  EXPECT_EQ(&t2, txn);
+  EXPECT_FALSE(cm.NextTxn(&requests, 1, &txn));
+
+  cm.TxnFinished(&t2);
+  EXPECT_TRUE(cm.NextTxn(&requests, 1, &txn));
+  EXPECT_EQ(&t3, txn);
+
+  END;
+}
+
+TEST(ContentionManager_AdaptiveCap) {
+  ContentionManager cm(2, 64);
+  AtomicQueue<Txn*> requests;
+  RestartedNoop txns[64];
+  Txn* txn;
+  EXPECT_EQ(64, cm.Cap());
+
+  // A window of restarts halves the cap.
+  for (int i = 0; i < 64; i++) {
+    txns[i].SetRestarts(1);
+    cm.TxnRestarted(&txns[i]);
+  }
+  cm.NextTxn(&requests, 0, &txn);
+  EXPECT_EQ(32, cm.Cap());
+
+  // A window of commits grows it again, additively.
+  for (int i = 0; i < 64; i++)
+    cm.TxnFinished(&txns[i]);
+  cm.NextTxn(&requests, 0, &txn);
+  EXPECT_EQ(36, cm.Cap());
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  ContentionManager_BackoffAndEscalation();
+  ContentionManager_AdaptiveCap();
+}
@@ -7,6 +7,8 @@
 
 #include "txn/lock_manager.h"
 
+#include <algorithm>
+
 LockManagerA::LockManagerA(deque<Txn *> *ready_txns)
 {
   ready_txns_ = ready_txns;
@@ -250,3 +252,351 @@ LockMode LockManagerB::Status(const Key &key, vector<Txn *> *owners)
     return UNLOCKED;
   }
 }
+
+LockManagerC::LockManagerC(deque<Txn *> *ready_txns, uint64 partition_size,
+                           int escalation_threshold)
+    : partition_size_(partition_size),
+      escalation_threshold_(escalation_threshold)
+{
+  ready_txns_ = ready_txns;
+}
+
+LockManagerC::~LockManagerC()
+{
+  for (LockTable::iterator it = lock_table_.begin(); it != lock_table_.end(); ++it)
+  {
+    delete it->second;
+  }
+  for (LockTable::iterator it = partition_table_.begin();
+       it != partition_table_.end(); ++it)
+  {
+    delete it->second;
+  }
+}
+
+bool LockManagerC::Compatible(LockMode a, LockMode b)
+{
+  // Multi-granularity compatibility matrix, indexed in LockMode order:
+  // UNLOCKED, S, X, IS, IX, SIX.
+  static const bool compatible[6][6] = {
+      {true, true, true, true, true, true},
+      {true, true, false, true, false, false},
+      {true, false, false, false, false, false},
+      {true, true, false, true, true, true},
+      {true, false, false, true, true, false},
+      {true, false, false, true, false, false},
+  };
+  return compatible[a][b];
+}
+
+int LockManagerC::GrantedCount(const deque<LockRequest> &requests)
+{
+  // Number of granted requests in each mode, so that each request can be
+  // tested against everything queued ahead of it without rescanning.
+  int held[6] = {0, 0, 0, 0, 0, 0};
+  int granted = 0;
+  for (deque<LockRequest>::const_iterator it = requests.begin();
+       it != requests.end(); ++it)
+  {
+    bool conflict = false;
+    for (int m = 0; m < 6 && !conflict; m++)
+    {
+      conflict = held[m] > 0 && !Compatible(static_cast<LockMode>(m), it->mode_);
+    }
+
+    // A txn never conflicts with itself, so only give up if the conflicting
+    // request belongs to some other txn.
+    if (conflict)
+    {
+      for (deque<LockRequest>::const_iterator prev = requests.begin();
+           prev != it; ++prev)
+      {
+        if (prev->txn_ != it->txn_ && !Compatible(prev->mode_, it->mode_))
+        {
+          return granted;
+        }
+      }
+    }
+
+    held[it->mode_]++;
+    granted++;
+  }
+  return granted;
+}
+
+bool LockManagerC::Request(LockTable *table, uint64 unit, Txn *txn, LockMode mode)
+{
+  deque<LockRequest> *requests;
+  LockTable::iterator it = table->find(unit);
+  if (it == table->end())
+  {
+    requests = new deque<LockRequest>();
+    (*table)[unit] = requests;
+  }
+  else
+  {
+    requests = it->second;
+  }
+
+  requests->push_back(LockRequest(mode, txn));
+  if (GrantedCount(*requests) == static_cast<int>(requests->size()))
+  {
+    return true;
+  }
+
+  txn_waits_[txn] += 1;
+  return false;
+}
+
+void LockManagerC::Drop(LockTable *table, uint64 unit, Txn *txn)
+{
+  LockTable::iterator entry = table->find(unit);
+  if (entry == table->end())
+  {
+    return;
+  }
+  deque<LockRequest> *requests = entry->second;
+
+  // The requests that stay granted are exactly the surviving members of the
+  // old granted prefix, which remain at the front of the queue.
+  int granted = GrantedCount(*requests);
+  int index = 0;
+  for (deque<LockRequest>::iterator it = requests->begin(); it != requests->end();)
+  {
+    if (it->txn_ != txn)
+    {
+      ++it;
+      index++;
+      continue;
+    }
+
+    if (index < granted)
+    {
+      granted--;
+    }
+    else if (--txn_waits_[txn] == 0)
+    {
+      // Cancelled 'txn's last pending request.
+      txn_waits_.erase(txn);
+    }
+    it = requests->erase(it);
+  }
+
+  int now_granted = GrantedCount(*requests);
+  for (int i = granted; i < now_granted; i++)
+  {
+    Txn *waiter = (*requests)[i].txn_;
+    if (--txn_waits_[waiter] == 0)
+    {
+      txn_waits_.erase(waiter);
+      ready_txns_->push_back(waiter);
+    }
+  }
+
+  if (requests->empty())
+  {
+    delete requests;
+    table->erase(entry);
+  }
+}
+
+void LockManagerC::RequestIntention(Txn *txn, const Key &key, LockMode mode)
+{
+  uint64 partition = Partition(key);
+  PartitionLock &lock = txn_locks_[txn].partitions_[partition];
+  lock.keys_++;
+
+  // IX covers IS, so a txn needs at most one request of each per partition.
+  if (lock.mode_ == INTENTION_EXCLUSIVE || lock.mode_ == mode)
+  {
+    return;
+  }
+  lock.mode_ = mode;
+  Request(&partition_table_, partition, txn, mode);
+}
+
+bool LockManagerC::LockTxn(Txn *txn, const KeySet &readset,
+                           const KeySet &writeset)
+{
+  if (static_cast<int>(readset.size() + writeset.size()) <= escalation_threshold_)
+  {
+    // Writes first, so that partitions holding both reads and writes only
+    // get a single IX request.
+    for (KeySet::const_iterator it = writeset.begin(); it != writeset.end(); ++it)
+    {
+      WriteLock(txn, *it);
+    }
+    for (KeySet::const_iterator it = readset.begin(); it != readset.end(); ++it)
+    {
+      ReadLock(txn, *it);
+    }
+    return txn_waits_.count(txn) == 0;
+  }
+
+  // Escalated: S for partitions that are only read, X for partitions that are
+  // only written, SIX for partitions that are both read and written.
+  map<uint64, LockMode> modes;
+  for (KeySet::const_iterator it = readset.begin(); it != readset.end(); ++it)
+  {
+    modes[Partition(*it)] = SHARED;
+  }
+  for (KeySet::const_iterator it = writeset.begin(); it != writeset.end(); ++it)
+  {
+    map<uint64, LockMode>::iterator mode = modes.find(Partition(*it));
+    if (mode == modes.end())
+    {
+      modes[Partition(*it)] = EXCLUSIVE;
+    }
+    else if (mode->second == SHARED)
+    {
+      mode->second = SHARED_INTENTION_EXCLUSIVE;
+    }
+  }
+
+  TxnLocks &locks = txn_locks_[txn];
+  for (map<uint64, LockMode>::iterator it = modes.begin(); it != modes.end(); ++it)
+  {
+    PartitionLock &lock = locks.partitions_[it->first];
+    lock.mode_ = it->second;
+    lock.keys_ = -1;
+    Request(&partition_table_, it->first, txn, it->second);
+  }
+
+  // Keys written under a SIX partition still need their own X locks.
+  for (KeySet::const_iterator it = writeset.begin(); it != writeset.end(); ++it)
+  {
+    if (modes[Partition(*it)] == SHARED_INTENTION_EXCLUSIVE)
+    {
+      locks.keys_.push_back(*it);
+      Request(&lock_table_, *it, txn, EXCLUSIVE);
+    }
+  }
+
+  return txn_waits_.count(txn) == 0;
+}
+
+void LockManagerC::ReleaseTxn(Txn *txn)
+{
+  unordered_map<Txn *, TxnLocks>::iterator locks = txn_locks_.find(txn);
+  if (locks == txn_locks_.end())
+  {
+    return;
+  }
+
+  for (vector<Key>::iterator it = locks->second.keys_.begin();
+       it != locks->second.keys_.end(); ++it)
+  {
+    Drop(&lock_table_, *it, txn);
+  }
+  for (map<uint64, PartitionLock>::iterator it = locks->second.partitions_.begin();
+       it != locks->second.partitions_.end(); ++it)
+  {
+    Drop(&partition_table_, it->first, txn);
+  }
+
+  txn_waits_.erase(txn);
+  txn_locks_.erase(locks);
+}
+
+bool LockManagerC::ReadLock(Txn *txn, const Key &key)
+{
+  RequestIntention(txn, key, INTENTION_SHARED);
+  txn_locks_[txn].keys_.push_back(key);
+  Request(&lock_table_, key, txn, SHARED);
+  return txn_waits_.count(txn) == 0;
+}
+
+bool LockManagerC::WriteLock(Txn *txn, const Key &key)
+{
+  RequestIntention(txn, key, INTENTION_EXCLUSIVE);
+  txn_locks_[txn].keys_.push_back(key);
+  Request(&lock_table_, key, txn, EXCLUSIVE);
+  return txn_waits_.count(txn) == 0;
+}
+
+void LockManagerC::Release(Txn *txn, const Key &key)
+{
+  Drop(&lock_table_, key, txn);
+
+  unordered_map<Txn *, TxnLocks>::iterator locks = txn_locks_.find(txn);
+  if (locks == txn_locks_.end())
+  {
+    return;
+  }
+
+  vector<Key> &keys = locks->second.keys_;
+  for (vector<Key>::iterator it = keys.begin(); it != keys.end(); ++it)
+  {
+    if (*it == key)
+    {
+      keys.erase(it);
+      break;
+    }
+  }
+
+  // Drop the partition's intention lock along with its last key lock.
+  map<uint64, PartitionLock>::iterator partition =
+      locks->second.partitions_.find(Partition(key));
+  if (partition != locks->second.partitions_.end() &&
+      partition->second.keys_ > 0 && --partition->second.keys_ == 0)
+  {
+    Drop(&partition_table_, partition->first, txn);
+    locks->second.partitions_.erase(partition);
+  }
+
+  if (keys.empty() && locks->second.partitions_.empty())
+  {
+    txn_locks_.erase(locks);
+  }
+}
+
+LockMode LockManagerC::GrantedStatus(const deque<LockRequest> &requests,
+                                     int granted, vector<Txn *> *owners)
+{
+  owners->clear();
+  bool held[6] = {false, false, false, false, false, false};
+  for (int i = 0; i < granted; i++)
+  {
+    Txn *txn = requests[i].txn_;
+    held[requests[i].mode_] = true;
+    if (std::find(owners->begin(), owners->end(), txn) == owners->end())
+    {
+      owners->push_back(txn);
+    }
+  }
+
+  if (held[EXCLUSIVE])
+    return EXCLUSIVE;
+  if (held[SHARED_INTENTION_EXCLUSIVE] ||
+      (held[SHARED] && held[INTENTION_EXCLUSIVE]))
+    return SHARED_INTENTION_EXCLUSIVE;
+  if (held[SHARED])
+    return SHARED;
+  if (held[INTENTION_EXCLUSIVE])
+    return INTENTION_EXCLUSIVE;
+  if (held[INTENTION_SHARED])
+    return INTENTION_SHARED;
+  return UNLOCKED;
+}
+
+LockMode LockManagerC::Status(const Key &key, vector<Txn *> *owners)
+{
+  LockTable::iterator it = lock_table_.find(key);
+  if (it == lock_table_.end())
+  {
+    owners->clear();
+    return UNLOCKED;
+  }
+  return GrantedStatus(*it->second, GrantedCount(*it->second), owners);
+}
+
+LockMode LockManagerC::PartitionStatus(uint64 partition, vector<Txn *> *owners)
+{
+  LockTable::iterator it = partition_table_.find(partition);
+  if (it == partition_table_.end())
+  {
+    owners->clear();
+    return UNLOCKED;
+  }
+  return GrantedStatus(*it->second, GrantedCount(*it->second), owners);
+}
@@ -19,11 +19,15 @@ using std::tr1::unordered_map;
 class Txn;
 
 // This interface supports locks being held in both read/shared and
-// write/exclusive modes.
+// write/exclusive modes. The hierarchical lock manager (LockManagerC) also
+// uses the three intention modes on coarse-grained lock units.
 enum LockMode {
   UNLOCKED = 0,
   SHARED = 1,
   EXCLUSIVE = 2,
+  INTENTION_SHARED = 3,            // IS: shared locks will be taken below
+  INTENTION_EXCLUSIVE = 4,         // IX: exclusive locks will be taken below
+  SHARED_INTENTION_EXCLUSIVE = 5,  // SIX: SHARED on the unit, plus IX
 };
 
 class LockManager {
@@ -134,5 +138,102 @@ class LockManagerB : public LockManager {
   virtual LockMode Status(const Key& key, vector<Txn*>* owners);
 };
 
+// Version of the LockManager implementing multi-granularity locking over a
+// two-level hierarchy. The key space is split into partitions of
+// 'partition_size' consecutive keys, and each partition can be locked in any
+// of the five modes (IS, IX, S, SIX, X). Every key lock is covered by an
+// intention lock on its partition.
+//
+// A txn that touches more than 'escalation_threshold' keys is escalated:
+// instead of one lock per key it takes a single S (read-only), X (write-only)
+// or SIX (reads and writes) lock per partition, plus X locks on the keys it
+// writes under a SIX partition.
+//
+// Requests on each lock unit are granted strictly in FIFO order: a request is
+// granted once it is compatible with every request queued ahead of it.
+class LockManagerC : public LockManager {
+ public:
+  LockManagerC(deque<Txn*>* ready_txns, uint64 partition_size,
+               int escalation_threshold);
+  virtual ~LockManagerC();
+
+  // Requests every lock 'txn' needs in order to read the keys in 'readset'
+  // and write the keys in 'writeset', escalating to partition locks if the
+  // txn touches more than 'escalation_threshold' keys. Returns true if all
+  // locks are immediately granted, else returns false (and the txn is
+  // appended to 'ready_txns_' once its last lock is granted).
+  //
+  // Requires: No lock has previously been requested by this txn.
+  bool LockTxn(Txn* txn, const KeySet& readset, const KeySet& writeset);
+
+  // Releases all locks held by 'txn' and cancels all of its pending
+  // requests, granting any requests that become compatible.
+  void ReleaseTxn(Txn* txn);
+
+  // Single-key versions: take IS (resp. IX) on the key's partition and S
+  // (resp. X) on the key itself. Release drops the key lock, and the
+  // partition's intention lock once 'txn' holds no other key under it.
+  virtual bool ReadLock(Txn* txn, const Key& key);
+  virtual bool WriteLock(Txn* txn, const Key& key);
+  virtual void Release(Txn* txn, const Key& key);
+  virtual LockMode Status(const Key& key, vector<Txn*>* owners);
+
+  // Sets '*owners' to all txns holding a lock on 'partition' and returns the
+  // strongest mode held on it (UNLOCKED if none).
+  LockMode PartitionStatus(uint64 partition, vector<Txn*>* owners);
+
+  // Returns the partition containing 'key'.
+  uint64 Partition(const Key& key) const { return key / partition_size_; }
+
+ private:
+  typedef unordered_map<uint64, deque<LockRequest>*> LockTable;
+
+  // Lock held (or requested) by a txn on one partition.
+  struct PartitionLock {
+    PartitionLock() : mode_(UNLOCKED), keys_(0) {}
+    LockMode mode_;  // Strongest mode requested on the partition.
+    int keys_;       // Key locks taken under it, or -1 if locked coarsely.
+  };
+
+  // Locks requested by a txn, so that ReleaseTxn can find them.
+  struct TxnLocks {
+    vector<Key> keys_;
+    map<uint64, PartitionLock> partitions_;
+  };
+
+  // Returns true if a lock in mode 'a' can be held concurrently with a lock
+  // in mode 'b' by another txn.
+  static bool Compatible(LockMode a, LockMode b);
+
+  // Returns the number of requests at the front of 'requests' that are
+  // currently granted.
+  static int GrantedCount(const deque<LockRequest>& requests);
+
+  // Appends a request by 'txn' on 'unit' in 'table'. Returns true if it is
+  // granted immediately, otherwise counts it in 'txn_waits_'.
+  bool Request(LockTable* table, uint64 unit, Txn* txn, LockMode mode);
+
+  // Drops every request by 'txn' on 'unit' in 'table' and grants the
+  // requests that become compatible.
+  void Drop(LockTable* table, uint64 unit, Txn* txn);
+
+  // Takes the partition intention lock 'mode' for a key lock of 'txn',
+  // unless one covering it has already been requested for this partition.
+  void RequestIntention(Txn* txn, const Key& key, LockMode mode);
+
+  // Sets '*owners' to the txns owning the first 'granted' requests and
+  // returns the strongest mode they hold.
+  static LockMode GrantedStatus(const deque<LockRequest>& requests,
+                                int granted, vector<Txn*>* owners);
+
+  // Partition-level lock table (key-level locks live in 'lock_table_').
+  LockTable partition_table_;
+
+  unordered_map<Txn*, TxnLocks> txn_locks_;
+
+  uint64 partition_size_;
+  int escalation_threshold_;
+};
+
 #endif  // _LOCK_MANAGER_H_
 
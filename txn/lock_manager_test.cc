@@ -186,10 +186,104 @@ TEST(LockManagerB_LocksReleasedOutOfOrder) {
   END;
 }
 
+TEST(LockManagerC_IntentionLocks) {
+  deque<Txn*> ready_txns;
+  LockManagerC lm(&ready_txns, 100, 10);
+  vector<Txn*> owners;
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  Txn* t2 = reinterpret_cast<Txn*>(2);
+  Txn* t3 = reinterpret_cast<Txn*>(3);
+
+  // Txn 1 reads key 101: IS on partition 1, S on the key.
+  EXPECT_TRUE(lm.ReadLock(t1, 101));
+  EXPECT_EQ(SHARED, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(INTENTION_SHARED, lm.PartitionStatus(1, &owners));
+
+  // Txn 2 writes another key of the same partition. IX is compatible with IS.
+  EXPECT_TRUE(lm.WriteLock(t2, 102));
+  EXPECT_EQ(INTENTION_EXCLUSIVE, lm.PartitionStatus(1, &owners));
+  EXPECT_EQ(2, owners.size());
+
+  // Txn 3 writes key 101. Not granted.
+  EXPECT_FALSE(lm.WriteLock(t3, 101));
+  EXPECT_EQ(0, ready_txns.size());
+
+  // Txn 1 releases its lock. Txn 3 is granted its write lock.
+  lm.Release(t1, 101);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t3, owners[0]);
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t3, ready_txns.at(0));
+
+  // Releasing the last keys also releases the intention locks.
+  lm.Release(t2, 102);
+  lm.Release(t3, 101);
+  EXPECT_EQ(UNLOCKED, lm.PartitionStatus(1, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(101, &owners));
+
+  END;
+}
+
+TEST(LockManagerC_Escalation) {
+  deque<Txn*> ready_txns;
+  LockManagerC lm(&ready_txns, 100, 10);
+  vector<Txn*> owners;
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  Txn* t2 = reinterpret_cast<Txn*>(2);
+  Txn* t3 = reinterpret_cast<Txn*>(3);
+  Txn* t4 = reinterpret_cast<Txn*>(4);
+  Txn* t5 = reinterpret_cast<Txn*>(5);
+  Txn* t6 = reinterpret_cast<Txn*>(6);
+
+  // Txn 1 reads 20 keys of partition 0: a single S lock on the partition.
+  KeySet reads, writes;
+  for (Key k = 0; k < 20; k++)
+    reads.insert(k);
+  EXPECT_TRUE(lm.LockTxn(t1, reads, writes));
+  EXPECT_EQ(SHARED, lm.PartitionStatus(0, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(5, &owners));
+
+  // Txn 2 writes key 5 (IX conflicts with S), txn 3 reads another partition.
+  EXPECT_FALSE(lm.WriteLock(t2, 5));
+  EXPECT_TRUE(lm.ReadLock(t3, 150));
+
+  // Txn 1 releases everything. Txn 2 is granted its locks.
+  lm.ReleaseTxn(t1);
+  EXPECT_EQ(INTENTION_EXCLUSIVE, lm.PartitionStatus(0, &owners));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(5, &owners));
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t2, ready_txns.at(0));
+
+  // Txn 4 reads partition 2 and writes one of its keys: SIX plus X.
+  reads.clear();
+  for (Key k = 200; k < 220; k++)
+    reads.insert(k);
+  writes.insert(250);
+  EXPECT_TRUE(lm.LockTxn(t4, reads, writes));
+  EXPECT_EQ(SHARED_INTENTION_EXCLUSIVE, lm.PartitionStatus(2, &owners));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(250, &owners));
+
+  // Readers may still share partition 2, writers may not.
+  EXPECT_TRUE(lm.ReadLock(t5, 210));
+  EXPECT_FALSE(lm.WriteLock(t6, 211));
+
+  lm.ReleaseTxn(t4);
+  EXPECT_EQ(2, ready_txns.size());
+  EXPECT_EQ(t6, ready_txns.at(1));
+
+  END;
+}
+
 int main(int argc, char** argv) {
   LockManagerA_SimpleLocking();
   LockManagerA_LocksReleasedOutOfOrder();
   LockManagerB_SimpleLocking();
   LockManagerB_LocksReleasedOutOfOrder();
+  LockManagerC_IntentionLocks();
+  LockManagerC_Escalation();
 }
 
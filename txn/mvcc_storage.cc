@@ -5,8 +5,11 @@
 // Init the storage
 void MVCCStorage::InitStorage()
 {
+  // This is the only place records are created: the maps are read without
+  // locks from then on, so they must never change while txns are running.
   for (int i = 0; i < 1000000; i++)
   {
+    mvcc_data_[i] = new std::atomic<Version *>(NULL);
     Write(i, 0, 0);
     Mutex *key_mutex = new Mutex();
     mutexs_[i] = key_mutex;
@@ -16,9 +19,16 @@ void MVCCStorage::InitStorage()
 // Free memory.
 MVCCStorage::~MVCCStorage()
 {
-  for (unordered_map<Key, deque<Version *> *>::iterator it = mvcc_data_.begin();
+  for (unordered_map<Key, std::atomic<Version *> *>::iterator it = mvcc_data_.begin();
        it != mvcc_data_.end(); ++it)
   {
+    Version *version = it->second->load();
+    while (version != NULL)
+    {
+      Version *next = version->next_;
+      delete version;
+      version = next;
+    }
     delete it->second;
   }
 
@@ -36,13 +46,21 @@ MVCCStorage::~MVCCStorage()
 // Lock the key to protect its version_list. Remember to lock the key when you read/update the version_list
 void MVCCStorage::Lock(Key key)
 {
-  mutexs_[key]->Lock();
+  KeyMutex(key)->Lock();
 }
 
 // Unlock the key.
 void MVCCStorage::Unlock(Key key)
 {
-  mutexs_[key]->Unlock();
+  KeyMutex(key)->Unlock();
+}
+
+Mutex *MVCCStorage::KeyMutex(Key key)
+{
+  unordered_map<Key, Mutex *>::iterator it = mutexs_.find(key);
+  if (it == mutexs_.end())
+    DIE("MVCC record " << key << " does not exist.");
+  return it->second;
 }
 
 // MVCC Read
@@ -62,20 +80,140 @@ bool MVCCStorage::Read(Key key, Value *result, int txn_unique_id)
     return false;
   }
 
-  int maxVer = -1;
-  for (auto it = mvcc_data_[key]->begin(); it != mvcc_data_[key]->end(); it++)
+  Version *version = Visible(key, txn_unique_id);
+  if (version != NULL)
   {
-    if ((*it)->version_id_ <= txn_unique_id && (*it)->version_id_ > maxVer)
-    {
-      maxVer = std::max(maxVer, (*it)->version_id_);
-      (*it)->max_read_id_ = std::max((*it)->max_read_id_, txn_unique_id);
-      *result = (*it)->value_;
-    }
+    version->max_read_id_ = std::max(version->max_read_id_, txn_unique_id);
+    *result = version->value_;
+  }
+
+  return true;
+}
+
+bool MVCCStorage::ReadSnapshot(Key key, Value *result, int snapshot_id)
+{
+  Version *version = Visible(key, snapshot_id);
+  if (version == NULL)
+  {
+    return false;
+  }
+  *result = version->value_;
+  return true;
+}
+
+bool MVCCStorage::Peek(Key key, Value *result, int *version_id, int txn_unique_id)
+{
+  Version *version = Visible(key, txn_unique_id);
+  if (version == NULL)
+  {
+    *version_id = -1;
+    return false;
+  }
+  *result = version->value_;
+  *version_id = version->version_id_;
+  return true;
+}
+
+bool MVCCStorage::RegisterRead(Key key, int version_id, int txn_unique_id)
+{
+  Version *version = Visible(key, txn_unique_id);
+  if (version == NULL)
+  {
+    return version_id == -1;
+  }
+  if (version->version_id_ != version_id)
+  {
+    return false;
   }
+  version->max_read_id_ = std::max(version->max_read_id_, txn_unique_id);
+  return true;
+}
 
+bool MVCCStorage::Superseded(Key key, int txn_unique_id, int *successor_id)
+{
+  Version *successor = NULL;
+  Version *version = Newest(key);
+  while (version != NULL && version->version_id_ > txn_unique_id)
+  {
+    successor = version;
+    version = version->next_.load(std::memory_order_acquire);
+  }
+  if (successor == NULL)
+  {
+    return false;
+  }
+  *successor_id = successor->version_id_;
   return true;
 }
 
+bool MVCCStorage::ChangedSince(Key key, int snapshot_id)
+{
+  Version *newest = Newest(key);
+  return newest != NULL && newest->version_id_ > snapshot_id;
+}
+
+void MVCCStorage::VersionsSince(Key key, int snapshot_id, vector<int> *version_ids)
+{
+  for (Version *version = Newest(key);
+       version != NULL && version->version_id_ > snapshot_id;
+       version = version->next_.load(std::memory_order_acquire))
+  {
+    version_ids->push_back(version->version_id_);
+  }
+}
+
+Version *MVCCStorage::Visible(Key key, int id)
+{
+  unordered_map<Key, std::atomic<Version *> *>::iterator list = mvcc_data_.find(key);
+  if (list == mvcc_data_.end())
+  {
+    return NULL;
+  }
+
+  // Versions are ordered newest first.
+  Version *version = list->second->load(std::memory_order_acquire);
+  while (version != NULL && version->version_id_ > id)
+  {
+    version = version->next_.load(std::memory_order_acquire);
+  }
+  return version;
+}
+
+Version *MVCCStorage::Newest(Key key)
+{
+  unordered_map<Key, std::atomic<Version *> *>::iterator list = mvcc_data_.find(key);
+  if (list == mvcc_data_.end())
+  {
+    return NULL;
+  }
+  return list->second->load(std::memory_order_acquire);
+}
+
+bool MVCCStorage::ReadLatest(Key key, Value *result)
+{
+  Version *newest = Newest(key);
+  if (newest == NULL)
+  {
+    return false;
+  }
+  *result = newest->value_;
+  return true;
+}
+
+double MVCCStorage::Timestamp(Key key)
+{
+  if (mutexs_.find(key) == mutexs_.end())
+  {
+    return 0;
+  }
+
+  Lock(key);
+  Version *newest = Newest(key);
+  double time = (newest == NULL) ? 0 : newest->write_time_;
+  Unlock(key);
+  return time;
+}
+
 // Check whether apply or abort the write
 bool MVCCStorage::CheckWrite(Key key, int txn_unique_id)
 {
@@ -89,17 +227,10 @@ bool MVCCStorage::CheckWrite(Key key, int txn_unique_id)
   // Note that you don't have to call Lock(key) in this method, just
   // call Lock(key) before you call this method and call Unlock(key) afterward.
 
-  int maxVer = -1;
-  Version maxVerValue = Version();
-  for (auto element : *mvcc_data_[key])
-  {
-    if (element->version_id_ > maxVer)
-    {
-      maxVer = element->version_id_;
-      maxVerValue = *element;
-    }
-  }
-  return maxVerValue.max_read_id_ <= txn_unique_id;
+  // Txns that read the preceding version after 'txn_unique_id' should have
+  // seen this write.
+  Version *preceding = Visible(key, txn_unique_id);
+  return preceding == NULL || preceding->max_read_id_ <= txn_unique_id;
 }
 
 // MVCC Write, call this method only if CheckWrite return true.
@@ -113,28 +244,35 @@ void MVCCStorage::Write(Key key, Value value, int txn_unique_id)
   // Note that you don't have to call Lock(key) in this method, just
   // call Lock(key) before you call this method and call Unlock(key) afterward.
   // Note that the performance would be much better if you organize the versions in decreasing order.
-  Version *new_version = new Version();
-  new_version->value_ = value;
-  new_version->version_id_ = txn_unique_id;
-  new_version->max_read_id_ = txn_unique_id;
+  unordered_map<Key, std::atomic<Version *> *>::iterator list = mvcc_data_.find(key);
+  if (list == mvcc_data_.end())
+    DIE("MVCC record " << key << " does not exist.");
 
-  if (mvcc_data_.find(key) == mvcc_data_.end())
+  // Find the position of the new version. It is normally the newest, but a
+  // write that a later txn has already overtaken goes further down the list.
+  std::atomic<Version *> *link = list->second;
+  Version *next = link->load();
+  while (next != NULL && next->version_id_ > txn_unique_id)
   {
-    deque<Version *> *version_list = new deque<Version *>();
-    version_list->push_back(new_version);
-    mvcc_data_[key] = version_list;
+    link = &next->next_;
+    next = link->load();
   }
-  else
+
+  // Cek apakah ini update
+  if (next != NULL && next->version_id_ == txn_unique_id)
   {
-    // Cek apakah ini update
-    for (auto it = mvcc_data_[key]->begin(); it != mvcc_data_[key]->end(); it++)
-    {
-      if ((*it)->version_id_ == txn_unique_id)
-      {
-        (*it)->value_ = value;
-        return;
-      }
-    }
-    mvcc_data_[key]->push_back(new_version);
+    next->value_ = value;
+    next->write_time_ = GetTime();
+    return;
   }
+
+  Version *new_version = new Version();
+  new_version->value_ = value;
+  new_version->version_id_ = txn_unique_id;
+  new_version->max_read_id_ = txn_unique_id;
+  new_version->write_time_ = GetTime();
+  new_version->next_.store(next, std::memory_order_relaxed);
+
+  // Publish the fully initialized version to lock-free readers.
+  link->store(new_version, std::memory_order_release);
 }
@@ -2,6 +2,8 @@
 #ifndef _MVCC_STORAGE_H_
 #define _MVCC_STORAGE_H_
 
+#include <atomic>
+
 #include "txn/storage.h"
 
 // MVCC 'version' structure
@@ -9,9 +11,16 @@ struct Version {
   Value value_;      // The value of this version
   int max_read_id_;  // Largest timestamp of a transaction that read the version
   int version_id_;   // Timestamp of the transaction that created(wrote) the version
+  double write_time_;  // Wall-clock time at which the version was written
+  std::atomic<Version*> next_;  // Next older version of the same record
 };
 
 // MVCC storage
+//
+// Note that the set of records is fixed by InitStorage(): reads (including
+// the lock-free snapshot reads) look keys up without any lock, so no key may
+// be added once txns are running. Reads of unknown keys return false, and
+// writing or locking an unknown key dies.
 class MVCCStorage : public Storage {
  public:
   // If there exists a record for the specified key, sets '*result' equal to
@@ -19,13 +28,22 @@ class MVCCStorage : public Storage {
   // The third parameter is the txn_unique_id(txn timestamp), which is used for MVCC.
   virtual bool Read(Key key, Value* result, int txn_unique_id = 0);
 
-  // Inserts a new version with key and value
+  // Inserts a new version with key and value. The record must exist.
   // The third parameter is the txn_unique_id(txn timestamp), which is used for MVCC.
   virtual void Write(Key key, Value value, int txn_unique_id = 0);
 
-  // Returns the timestamp at which the record with the specified key was last
-  // updated (returns 0 if the record has never been updated). This is used for OCC.
-  virtual double Timestamp(Key key) {return 0;}
+  // Returns the time at which the newest version of the record with the
+  // specified key was written. Used when OCC runs over MVCC storage (ADAPTIVE
+  // mode). Locks the key itself.
+  virtual double Timestamp(Key key);
+
+  // Sets '*result' to the value of the newest version of the record with the
+  // specified key, without registering the read in the version's
+  // max_read_id_. Returns false if there is no such record. Used when the
+  // single-version modes run over MVCC storage (ADAPTIVE mode).
+  //
+  // Requires: the key is locked.
+  bool ReadLatest(Key key, Value* result);
   
   // Init storage
   virtual void InitStorage();
@@ -36,17 +54,76 @@ class MVCCStorage : public Storage {
   // Unlock the version_list of key
   virtual void Unlock(Key key);
   
-  // Check whether apply or abort the write
+  // Check whether apply or abort the write. The write is checked against the
+  // version it would directly follow, so a txn may still write a key that a
+  // later txn has already written (the new version is then inserted behind
+  // the later one).
   virtual bool CheckWrite (Key key, int txn_unique_id);
+
+  // Like Read(), but does not register the read. Also sets '*version_id' to
+  // the id of the version read, or to -1 if the txn sees no version.
+  //
+  // Requires: the key is locked.
+  bool Peek(Key key, Value* result, int* version_id, int txn_unique_id);
+
+  // Registers a read of the specified key, by the txn with id 'txn_unique_id',
+  // that returned the version with id 'version_id' (see Peek()). Returns false
+  // and registers nothing if that is no longer the version the txn sees.
+  //
+  // Requires: the key is locked.
+  bool RegisterRead(Key key, int version_id, int txn_unique_id);
+
+  // Returns true if the record with the specified key has a version newer
+  // than 'txn_unique_id', and sets '*successor_id' to the id of the oldest
+  // such version.
+  //
+  // Requires: the key is locked.
+  bool Superseded(Key key, int txn_unique_id, int* successor_id);
+
+  // Sets '*result' to the value of the record with the specified key as of
+  // snapshot 'snapshot_id' and returns true, or returns false if there is no
+  // such record. Takes no lock and does not register the read.
+  //
+  // Requires: no txn with an id <= snapshot_id is still running, so that no
+  //           version visible in the snapshot can still be written.
+  bool ReadSnapshot(Key key, Value* result, int snapshot_id);
+
+  // Returns true if the record with the specified key has a version newer
+  // than snapshot 'snapshot_id'.
+  //
+  // Requires: the key is locked.
+  bool ChangedSince(Key key, int snapshot_id);
+
+  // Appends the ids of the versions of the record with the specified key that
+  // are newer than snapshot 'snapshot_id' to '*version_ids'. Takes no lock.
+  //
+  // Requires: the record's versions were installed in id order (as SI and SSI
+  //           do), so that the newer ones are all at the front of its list.
+  void VersionsSince(Key key, int snapshot_id, vector<int>* version_ids);
   
   virtual ~MVCCStorage();
 
  private:
  
   friend class TxnProcessor;
+
+  // Returns the version of 'key' with the largest version_id_, or NULL if the
+  // key has no versions.
+  //
+  // Requires: the key is locked.
+  Version* Newest(Key key);
+
+  // Returns the newest version of 'key' with a version_id_ <= 'id', or NULL.
+  Version* Visible(Key key, int id);
+
+  // Returns the mutex of the record with key 'key'. Dies if there is none.
+  Mutex* KeyMutex(Key key);
   
-  // Storage for MVCC, each key has a linklist of versions
-  unordered_map<Key, deque<Version*>*> mvcc_data_;
+  // Storage for MVCC, each key has a linklist of versions, ordered newest
+  // first. Versions are never removed, and a writer (holding the key's lock)
+  // links in a new version only after it is fully initialized, so each list
+  // can be traversed without the lock.
+  unordered_map<Key, std::atomic<Version*>*> mvcc_data_;
   
   // Mutexs for each key
   unordered_map<Key, Mutex*> mutexs_;
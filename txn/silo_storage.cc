@@ -0,0 +1,117 @@
+
+#include "txn/silo_storage.h"
+
+#include <sched.h>
+
+// Number of records created by InitStorage.
+#define SILO_RECORD_COUNT 1000000
+
+// Init the storage
+void SiloStorage::InitStorage()
+{
+  records_ = new SiloRecord[SILO_RECORD_COUNT];
+  for (int i = 0; i < SILO_RECORD_COUNT; i++)
+  {
+    index_[i] = &records_[i];
+  }
+}
+
+// Free memory.
+SiloStorage::~SiloStorage()
+{
+  delete[] records_;
+}
+
+SiloRecord *SiloStorage::Record(Key key)
+{
+  unordered_map<Key, SiloRecord *>::iterator it = index_.find(key);
+  if (it == index_.end())
+    DIE("Silo record " << key << " does not exist.");
+  return it->second;
+}
+
+bool SiloStorage::Read(Key key, Value *result, int txn_unique_id)
+{
+  uint64 tid;
+  return StableRead(key, result, &tid);
+}
+
+void SiloStorage::Write(Key key, Value value, int txn_unique_id)
+{
+  Record(key)->value_.store(value, std::memory_order_relaxed);
+}
+
+bool SiloStorage::StableRead(Key key, Value *result, uint64 *tid)
+{
+  unordered_map<Key, SiloRecord *>::iterator it = index_.find(key);
+  if (it == index_.end())
+  {
+    *tid = 0;
+    return false;
+  }
+
+  SiloRecord *record = it->second;
+  while (true)
+  {
+    uint64 before = record->tid_.load(std::memory_order_acquire);
+    if (before & kLockBit)
+    {
+      // A writer is installing a new version.
+      sched_yield();
+      continue;
+    }
+
+    Value value = record->value_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // The value is consistent with 'before' iff the TID did not change.
+    if (record->tid_.load(std::memory_order_relaxed) == before)
+    {
+      *result = value;
+      *tid = before;
+      return true;
+    }
+  }
+}
+
+uint64 SiloStorage::RecordTid(Key key)
+{
+  // Records that do not exist can never be written, so their TID stays 0.
+  unordered_map<Key, SiloRecord *>::iterator it = index_.find(key);
+  if (it == index_.end())
+    return 0;
+  return it->second->tid_.load(std::memory_order_acquire);
+}
+
+void SiloStorage::LockRecord(Key key)
+{
+  SiloRecord *record = Record(key);
+  uint64 tid = record->tid_.load(std::memory_order_relaxed);
+  while ((tid & kLockBit) ||
+         !record->tid_.compare_exchange_weak(tid, tid | kLockBit,
+                                             std::memory_order_acquire))
+  {
+    if (tid & kLockBit)
+    {
+      sched_yield();
+      tid = record->tid_.load(std::memory_order_relaxed);
+    }
+  }
+  // Keep the stores made under the lock from becoming visible before the lock
+  // bit, or StableRead() could pair a new value with the old TID.
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SiloStorage::UnlockRecord(Key key)
+{
+  SiloRecord *record = Record(key);
+  record->tid_.store(record->tid_.load(std::memory_order_relaxed) & ~kLockBit,
+                     std::memory_order_release);
+}
+
+void SiloStorage::InstallAndUnlock(Key key, Value value, uint64 tid)
+{
+  SiloRecord *record = Record(key);
+  record->value_.store(value, std::memory_order_relaxed);
+  record->tid_.store(tid & ~kLockBit, std::memory_order_release);
+}
@@ -0,0 +1,84 @@
+#ifndef _SILO_STORAGE_H_
+#define _SILO_STORAGE_H_
+
+#include <atomic>
+
+#include "txn/storage.h"
+
+// Silo 'record' structure. The TID word holds the id of the txn that last
+// wrote the record, with the lowest bit doubling as the record's lock:
+//
+//   bits 63..32: epoch in which the writing txn committed
+//   bits 31..1:  sequence number within that epoch
+//   bit 0:       lock bit
+struct SiloRecord {
+  SiloRecord() : tid_(0), value_(0) {}
+  std::atomic<uint64> tid_;
+  std::atomic<Value> value_;
+};
+
+// Storage for Silo-style OCC. Records are never deleted or moved, so every
+// worker can read and lock them directly; the only shared state written on
+// the commit path is the records themselves.
+//
+// Note that the set of records is fixed by InitStorage(): like MVCCStorage,
+// SiloStorage does not support inserting new keys once txns are running.
+class SiloStorage : public Storage {
+ public:
+  static const uint64 kLockBit = 1;
+
+  // Builds a TID from an epoch and a sequence number within that epoch.
+  static uint64 MakeTid(uint64 epoch, uint64 sequence) {
+    return (epoch << 32) | (sequence << 1);
+  }
+
+  // Returns the epoch in which the txn with id 'tid' committed.
+  static uint64 TidEpoch(uint64 tid) { return tid >> 32; }
+
+  // If there exists a record for the specified key, sets '*result' equal to
+  // its current value and returns true, else returns false.
+  virtual bool Read(Key key, Value* result, int txn_unique_id = 0);
+
+  // Overwrites the value of the record with key 'key', without locking it.
+  // Only used to initialize the storage.
+  virtual void Write(Key key, Value value, int txn_unique_id = 0);
+
+  // Silo does not use wall-clock timestamps.
+  virtual double Timestamp(Key key) { return 0; }
+
+  // Init storage
+  virtual void InitStorage();
+
+  virtual ~SiloStorage();
+
+  // Reads a consistent <value, TID> pair of the record with key 'key',
+  // waiting out any concurrent writer. Sets '*tid' to 0 and returns false if
+  // the record does not exist.
+  bool StableRead(Key key, Value* result, uint64* tid);
+
+  // Returns the current TID word of the record, including its lock bit (0 if
+  // the record does not exist).
+  uint64 RecordTid(Key key);
+
+  // Spins until the lock bit of the record with key 'key' is acquired.
+  void LockRecord(Key key);
+
+  // Releases the record's lock without modifying it.
+  void UnlockRecord(Key key);
+
+  // Sets the record's value and TID, releasing its lock.
+  //
+  // Requires: the lock of the record is held by the caller.
+  void InstallAndUnlock(Key key, Value value, uint64 tid);
+
+ private:
+  // Returns the record with key 'key'. Dies if there is none.
+  SiloRecord* Record(Key key);
+
+  // All records, allocated in a single block by InitStorage().
+  SiloRecord* records_;
+  unordered_map<Key, SiloRecord*> index_;
+};
+
+#endif  // _SILO_STORAGE_H_
+
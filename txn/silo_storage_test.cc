@@ -0,0 +1,60 @@
+
+#include "txn/silo_storage.h"
+
+#include "utils/testing.h"
+
+TEST(SiloStorage_TidOrder) {
+  // TIDs order by epoch first, then by sequence number within the epoch.
+  EXPECT_EQ(7, SiloStorage::TidEpoch(SiloStorage::MakeTid(7, 3)));
+  EXPECT_TRUE(SiloStorage::MakeTid(1, 1) > SiloStorage::MakeTid(0, 1000000));
+  EXPECT_TRUE(SiloStorage::MakeTid(1, 2) > SiloStorage::MakeTid(1, 1));
+
+  // Bumping a TID by one sequence number keeps its epoch and never touches
+  // the lock bit.
+  uint64 tid = SiloStorage::MakeTid(2, 5) + SiloStorage::MakeTid(0, 1);
+  EXPECT_EQ(SiloStorage::MakeTid(2, 6), tid);
+  EXPECT_EQ(2, SiloStorage::TidEpoch(tid));
+  EXPECT_EQ(0, (tid & SiloStorage::kLockBit));
+
+  END;
+}
+
+TEST(SiloStorage_LockedRecordFailsValidation) {
+  SiloStorage storage;
+  storage.InitStorage();
+  storage.Write(1, 10);
+
+  Value value;
+  uint64 tid;
+  EXPECT_TRUE(storage.StableRead(1, &value, &tid));
+  EXPECT_EQ(10, value);
+  EXPECT_EQ(tid, storage.RecordTid(1));
+
+  // While some txn holds the record's lock, a read of it no longer validates,
+  // even though the record has not changed yet.
+  storage.LockRecord(1);
+  EXPECT_TRUE(storage.RecordTid(1) != tid);
+  EXPECT_EQ(tid, (storage.RecordTid(1) & ~SiloStorage::kLockBit));
+  storage.UnlockRecord(1);
+  EXPECT_EQ(tid, storage.RecordTid(1));
+
+  // Installing a write publishes the writer's TID and releases the lock.
+  uint64 newer = SiloStorage::MakeTid(1, 1);
+  storage.LockRecord(1);
+  storage.InstallAndUnlock(1, 20, newer);
+  EXPECT_EQ(newer, storage.RecordTid(1));
+  EXPECT_TRUE(storage.StableRead(1, &value, &tid));
+  EXPECT_EQ(20, value);
+  EXPECT_EQ(newer, tid);
+
+  // A record that does not exist reads as missing, with TID 0.
+  EXPECT_FALSE(storage.StableRead(-1, &value, &tid));
+  EXPECT_EQ(0, tid);
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  SiloStorage_TidOrder();
+  SiloStorage_LockedRecordFailsValidation();
+}
@@ -1,21 +1,6 @@
 
 #include "txn/storage.h"
 
-bool Storage::Read(Key key, Value* result, int txn_unique_id) {
-  if (data_.count(key)) {
-    *result = data_[key];
-    return true;
-  } else {
-    return false;
-  }
-}
-
-// Write value and timestamps
-void Storage::Write(Key key, Value value, int txn_unique_id) {
-  data_[key] = value;
-  timestamps_[key] = GetTime();
-}
-
 double Storage::Timestamp(Key key) {
   if (timestamps_.count(key) == 0)
     return 0;
@@ -21,12 +21,24 @@ class Storage {
   // If there exists a record for the specified key, sets '*result' equal to
   // the value associated with the key and returns true, else returns false;
   // Note that the third parameter is only used for MVCC, the default vaule is 0.
-  virtual bool Read(Key key, Value* result, int txn_unique_id = 0);
+  //
+  // Defined inline so that callers that know they have a plain Storage (see
+  // TxnProcessor::ReadKeys) can have the lookup inlined.
+  virtual bool Read(Key key, Value* result, int txn_unique_id = 0) {
+    unordered_map<Key, Value>::iterator it = data_.find(key);
+    if (it == data_.end())
+      return false;
+    *result = it->second;
+    return true;
+  }
 
   // Inserts the record <key, value>, replacing any previous record with the
   // same key.
   // Note that the third parameter is only used for MVCC, the default vaule is 0.
-  virtual void Write(Key key, Value value, int txn_unique_id = 0);
+  virtual void Write(Key key, Value value, int txn_unique_id = 0) {
+    data_[key] = value;
+    timestamps_[key] = GetTime();
+  }
 
   // Returns the timestamp at which the record with the specified key was last
   // updated (returns 0 if the record has never been updated). This is used for OCC.
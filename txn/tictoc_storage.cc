@@ -0,0 +1,132 @@
+
+#include "txn/tictoc_storage.h"
+
+#include <sched.h>
+
+// Number of records created by InitStorage.
+#define TICTOC_RECORD_COUNT 1000000
+
+// Init the storage
+void TicTocStorage::InitStorage()
+{
+  records_ = new TicTocRecord[TICTOC_RECORD_COUNT];
+  for (int i = 0; i < TICTOC_RECORD_COUNT; i++)
+  {
+    index_[i] = &records_[i];
+  }
+}
+
+// Free memory.
+TicTocStorage::~TicTocStorage()
+{
+  delete[] records_;
+}
+
+TicTocRecord *TicTocStorage::Record(Key key)
+{
+  unordered_map<Key, TicTocRecord *>::iterator it = index_.find(key);
+  if (it == index_.end())
+    DIE("TicToc record " << key << " does not exist.");
+  return it->second;
+}
+
+bool TicTocStorage::Read(Key key, Value *result, int txn_unique_id)
+{
+  uint64 wts, rts;
+  return StableRead(key, result, &wts, &rts);
+}
+
+void TicTocStorage::Write(Key key, Value value, int txn_unique_id)
+{
+  Record(key)->value_.store(value, std::memory_order_relaxed);
+}
+
+bool TicTocStorage::StableRead(Key key, Value *result, uint64 *wts, uint64 *rts)
+{
+  unordered_map<Key, TicTocRecord *>::iterator it = index_.find(key);
+  if (it == index_.end())
+  {
+    *wts = 0;
+    *rts = 0;
+    return false;
+  }
+
+  TicTocRecord *record = it->second;
+  while (true)
+  {
+    uint64 before = record->latch_.load(std::memory_order_acquire);
+    if (before & 1)
+    {
+      // The record is locked by a committing txn.
+      sched_yield();
+      continue;
+    }
+
+    Value value = record->value_.load(std::memory_order_relaxed);
+    uint64 read_wts = record->wts_.load(std::memory_order_relaxed);
+    uint64 read_rts = record->rts_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (record->latch_.load(std::memory_order_relaxed) == before)
+    {
+      *result = value;
+      *wts = read_wts;
+      *rts = read_rts;
+      return true;
+    }
+  }
+}
+
+bool TicTocStorage::TryLockRecord(Key key)
+{
+  TicTocRecord *record = Record(key);
+  uint64 latch = record->latch_.load(std::memory_order_relaxed);
+  if ((latch & 1) ||
+      !record->latch_.compare_exchange_strong(latch, latch + 1,
+                                              std::memory_order_acquire))
+    return false;
+  // Keep the stores made under the latch (ExtendRts, InstallAndUnlock) from
+  // becoming visible before the latch itself, or StableRead() could accept a
+  // half-written record.
+  std::atomic_thread_fence(std::memory_order_release);
+  return true;
+}
+
+void TicTocStorage::LockRecord(Key key)
+{
+  while (!TryLockRecord(key))
+  {
+    sched_yield();
+  }
+}
+
+void TicTocStorage::UnlockRecord(Key key)
+{
+  Record(key)->latch_.fetch_add(1, std::memory_order_release);
+}
+
+uint64 TicTocStorage::LockedWts(Key key)
+{
+  return Record(key)->wts_.load(std::memory_order_relaxed);
+}
+
+uint64 TicTocStorage::LockedRts(Key key)
+{
+  return Record(key)->rts_.load(std::memory_order_relaxed);
+}
+
+void TicTocStorage::ExtendRts(Key key, uint64 ts)
+{
+  TicTocRecord *record = Record(key);
+  if (record->rts_.load(std::memory_order_relaxed) < ts)
+    record->rts_.store(ts, std::memory_order_relaxed);
+}
+
+void TicTocStorage::InstallAndUnlock(Key key, Value value, uint64 ts)
+{
+  TicTocRecord *record = Record(key);
+  record->value_.store(value, std::memory_order_relaxed);
+  record->wts_.store(ts, std::memory_order_relaxed);
+  record->rts_.store(ts, std::memory_order_relaxed);
+  record->latch_.fetch_add(1, std::memory_order_release);
+}
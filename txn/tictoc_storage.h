@@ -0,0 +1,84 @@
+#ifndef _TICTOC_STORAGE_H_
+#define _TICTOC_STORAGE_H_
+
+#include <atomic>
+
+#include "txn/storage.h"
+
+// TicToc 'record' structure. The current value is valid over the logical
+// time range [wts_, rts_]. 'latch_' is a sequence lock: it is odd while the
+// record is locked, and grows every time the record is unlocked, so readers
+// can tell whether the record changed under them.
+struct TicTocRecord {
+  TicTocRecord() : latch_(0), wts_(0), rts_(0), value_(0) {}
+  std::atomic<uint64> latch_;
+  std::atomic<uint64> wts_;   // Commit timestamp of the txn that wrote value_
+  std::atomic<uint64> rts_;   // Latest timestamp at which value_ is valid
+  std::atomic<Value> value_;
+};
+
+// Storage for TicToc timestamp-ordering concurrency control. Records are
+// never deleted or moved, so workers access them directly.
+//
+// Note that the set of records is fixed by InitStorage(): like MVCCStorage,
+// TicTocStorage does not support inserting new keys once txns are running.
+class TicTocStorage : public Storage {
+ public:
+  // If there exists a record for the specified key, sets '*result' equal to
+  // its current value and returns true, else returns false.
+  virtual bool Read(Key key, Value* result, int txn_unique_id = 0);
+
+  // Overwrites the value of the record with key 'key', without locking it.
+  // Only used to initialize the storage.
+  virtual void Write(Key key, Value value, int txn_unique_id = 0);
+
+  // TicToc does not use wall-clock timestamps.
+  virtual double Timestamp(Key key) { return 0; }
+
+  // Init storage
+  virtual void InitStorage();
+
+  virtual ~TicTocStorage();
+
+  // Reads a consistent <value, wts, rts> triple of the record with key
+  // 'key', waiting out any concurrent writer. Sets '*wts' and '*rts' to 0
+  // and returns false if the record does not exist.
+  bool StableRead(Key key, Value* result, uint64* wts, uint64* rts);
+
+  // Spins until the record with key 'key' is locked.
+  void LockRecord(Key key);
+
+  // Locks the record if it is not locked already. Returns true on success.
+  bool TryLockRecord(Key key);
+
+  // Releases the record's lock.
+  void UnlockRecord(Key key);
+
+  // Returns the record's current wts/rts.
+  //
+  // Requires: the lock of the record is held by the caller.
+  uint64 LockedWts(Key key);
+  uint64 LockedRts(Key key);
+
+  // Extends the range in which the record's current value is valid up to
+  // 'ts'.
+  //
+  // Requires: the lock of the record is held by the caller.
+  void ExtendRts(Key key, uint64 ts);
+
+  // Installs 'value' as written at timestamp 'ts', and releases the lock.
+  //
+  // Requires: the lock of the record is held by the caller.
+  void InstallAndUnlock(Key key, Value value, uint64 ts);
+
+ private:
+  // Returns the record with key 'key'. Dies if there is none.
+  TicTocRecord* Record(Key key);
+
+  // All records, allocated in a single block by InitStorage().
+  TicTocRecord* records_;
+  unordered_map<Key, TicTocRecord*> index_;
+};
+
+#endif  // _TICTOC_STORAGE_H_
+
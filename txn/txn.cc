@@ -3,21 +3,26 @@
 
 bool Txn::Read(const Key& key, Value* value) {
   // Check that key is in readset/writeset.
-  if (readset_.count(key) == 0 && writeset_.count(key) == 0)
+  bool in_readset = readset_.count(key);
+  if (!in_readset && writeset_.count(key) == 0)
     DIE("Invalid read (key not in readset or writeset).");
 
   // Reads have no effect if we have already aborted or committed.
   if (status_ != INCOMPLETE)
     return false;
 
+  // Reading back a value the txn has already written does not make the write
+  // depend on the stored record.
+  if (!in_readset && writes_.count(key) == 0)
+    read_writeset_.insert(key);
+
   // 'reads_' has already been populated by TxnProcessor, so it should contain
   // the target value iff the record appears in the database.
-  if (reads_.count(key)) {
-    *value = reads_[key];
-    return true;
-  } else {
+  KeyValueMap::iterator it = reads_.find(key);
+  if (it == reads_.end())
     return false;
-  }
+  *value = it->second;
+  return true;
 }
 
 void Txn::Write(const Key& key, const Value& value) {
@@ -38,7 +43,7 @@ void Txn::Write(const Key& key, const Value& value) {
 }
 
 void Txn::CheckReadWriteSets() {
-  for (set<Key>::iterator it = writeset_.begin();
+  for (KeySet::iterator it = writeset_.begin();
        it != writeset_.end(); ++it) {
     if (readset_.count(*it) > 0) {
       DIE("Overlapping read/write sets\n.");
@@ -46,12 +51,28 @@ void Txn::CheckReadWriteSets() {
   }
 }
 
+void Txn::Reset() {
+  readset_.clear();
+  writeset_.clear();
+  reads_.clear();
+  writes_.clear();
+  read_writeset_.clear();
+  read_versions_.clear();
+  read_rts_.clear();
+  status_ = INCOMPLETE;
+  callback_ = NULL;
+  restarts_ = 0;
+}
+
 void Txn::CopyTxnInternals(Txn* txn) const {
-  txn->readset_ = set<Key>(this->readset_);
-  txn->writeset_ = set<Key>(this->writeset_);
-  txn->reads_ = map<Key, Value>(this->reads_);
-  txn->writes_ = map<Key, Value>(this->writes_);
+  txn->readset_ = this->readset_;
+  txn->writeset_ = this->writeset_;
+  txn->reads_ = this->reads_;
+  txn->writes_ = this->writes_;
+  txn->read_writeset_ = this->read_writeset_;
   txn->status_ = this->status_;
   txn->unique_id_ = this->unique_id_;
   txn->occ_start_time_ = this->occ_start_time_;
+  txn->read_versions_ = this->read_versions_;
+  txn->read_rts_ = this->read_rts_;
 }
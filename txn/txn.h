@@ -2,16 +2,41 @@
 #ifndef _TXN_H_
 #define _TXN_H_
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <vector>
 
 #include "txn/common.h"
+#include "utils/task.h"
 
 using std::map;
 using std::set;
 using std::vector;
 
+class Txn;
+class TxnCallback;
+class TxnProcessor;
+
+// Task that runs a TxnProcessor method on a txn. Each txn embeds one, which
+// is reused every time the txn is dispatched to a worker thread, so that a
+// dispatch does not allocate.
+class TxnTask : public Task {
+ public:
+  TxnTask() : processor_(NULL), method_(NULL), txn_(NULL) {}
+
+  // Defined in txn_processor.cc.
+  virtual void Run();
+  virtual bool DeleteAfterRun() { return false; }
+
+ private:
+  friend class TxnProcessor;
+
+  TxnProcessor* processor_;
+  void (TxnProcessor::*method_)(Txn*);
+  Txn* txn_;
+};
+
 // Txns can have five distinct status values:
 enum TxnStatus {
   INCOMPLETE = 0,   // Not yet executed
@@ -24,7 +49,7 @@ enum TxnStatus {
 class Txn {
  public:
   // Commit vote defauls to false. Only by calling "commit"
-  Txn() : status_(INCOMPLETE) {}
+  Txn() : status_(INCOMPLETE), occ_pins_(0), callback_(NULL), restarts_(0) {}
   virtual ~Txn() {}
   virtual Txn * clone() const = 0;    // Virtual constructor (copying)
 
@@ -38,6 +63,13 @@ class Txn {
   // an error occurs.
   void CheckReadWriteSets();
 
+  // Returns the txn to the state of a newly constructed txn with empty read
+  // and write sets, so that it can be re-parameterized and submitted again.
+  // Keeps the memory of its buffers.
+  //
+  // Requires: the txn is not being processed by a TxnProcessor.
+  void Reset();
+
  protected:
   // Copies the internals of this txn into a given transaction (i.e.
   // the readset, writeset, and so forth).  Be sure to modify this method
@@ -45,6 +77,7 @@ class Txn {
   void CopyTxnInternals(Txn* txn) const;
 
   friend class TxnProcessor;
+  friend class ContentionManager;
 
   // Method to be used inside 'Execute()' function when reading records from
   // the database. If record corresponding with specified 'key' exists, sets
@@ -83,16 +116,20 @@ class Txn {
 
   // Set of all keys that may need to be read in order to execute the
   // transaction.
-  set<Key> readset_;
+  KeySet readset_;
 
   // Set of all keys that may be updated when executing the transaction.
-  set<Key> writeset_;
+  KeySet writeset_;
 
   // Results of reads performed by the transaction.
-  map<Key, Value> reads_;
+  KeyValueMap reads_;
 
   // Key, Value pairs WRITTEN by the transaction.
-  map<Key, Value> writes_;
+  KeyValueMap writes_;
+
+  // Keys in the writeset whose stored value the transaction logic read (before
+  // writing them). The rest of the writeset is written blind.
+  KeySet read_writeset_;
 
   // Transaction's current execution status.
   TxnStatus status_;
@@ -102,6 +139,27 @@ class Txn {
 
   // Start time (used for OCC).
   double occ_start_time_;
+
+  // Number of txns still checking their writes against this txn's writeset
+  // during parallel validation (used for P_OCC).
+  std::atomic<int> occ_pins_;
+
+  // Version of each record at the time it was read, i.e. its TID word (used
+  // for Silo) or its write timestamp (used for TicToc).
+  KeyVersionMap read_versions_;
+
+  // Read timestamp of each record at the time it was read (used for TicToc).
+  KeyVersionMap read_rts_;
+
+  // If non-NULL, receives the txn once it has committed or aborted instead of
+  // the TxnProcessor's result queue. Not owned by the txn.
+  TxnCallback* callback_;
+
+  // Number of times the txn has been restarted by the TxnProcessor.
+  int restarts_;
+
+  // Task used by the TxnProcessor to run the txn on a worker thread.
+  TxnTask task_;
 };
 
 #endif  // _TXN_H_
@@ -0,0 +1,53 @@
+// Pool of reusable txns.
+
+#ifndef _TXN_POOL_H_
+#define _TXN_POOL_H_
+
+#include <vector>
+
+#include "txn/txn.h"
+
+using std::vector;
+
+// Keeps finished txns of type T so that they can be handed out again instead
+// of allocating a new txn per request. A recycled txn keeps the memory of its
+// key sets and buffers, so once the pool has warmed up, getting a txn and
+// re-parameterizing it does not allocate.
+//
+// Not thread safe: a pool is meant to be owned by a single client thread.
+template<class T>
+class TxnPool {
+ public:
+  TxnPool() {}
+
+  // Deletes all txns in the pool. Txns that are still checked out are not
+  // owned by the pool.
+  ~TxnPool() {
+    for (size_t i = 0; i < free_.size(); i++)
+      delete free_[i];
+  }
+
+  // Returns a txn that has been Reset(), constructing a new one with T's
+  // default constructor if the pool is empty.
+  T* Get() {
+    if (free_.empty())
+      return new T();
+    T* txn = free_.back();
+    free_.pop_back();
+    return txn;
+  }
+
+  // Returns 'txn' to the pool. The pool takes ownership of it.
+  //
+  // Requires: 'txn' has been handed back by the TxnProcessor (or was never
+  //           submitted).
+  void Recycle(T* txn) {
+    txn->Reset();
+    free_.push_back(txn);
+  }
+
+ private:
+  vector<T*> free_;
+};
+
+#endif  // _TXN_POOL_H_
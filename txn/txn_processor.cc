@@ -1,26 +1,105 @@
 
 #include "txn/txn_processor.h"
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
 #include <set>
 
 #include "txn/lock_manager.h"
 
-// Thread & queue counts for StaticThreadPool initialization.
-#define THREAD_COUNT 8
+// Number of rounds an idle DIRECT worker spins looking for work before it
+// parks, and the number of pause instructions per round.
+#define DIRECT_SPIN_ROUNDS 64
+#define DIRECT_PAUSES_PER_ROUND 32
 
-TxnProcessor::TxnProcessor(CCMode mode)
-    : mode_(mode), tp_(THREAD_COUNT), next_unique_id_(1)
+// Interval (in seconds) at which the Silo epoch advances.
+#define SILO_EPOCH_DURATION 0.005
+
+// Length (in seconds) of a Calvin batching epoch.
+#define CALVIN_EPOCH_DURATION 0.01
+
+// Bounds of the contention manager's cap on concurrently executing txns.
+#define CM_MIN_IN_FLIGHT 2
+#define CM_MAX_IN_FLIGHT 1024
+
+// ADAPTIVE mode tuning. Metrics are collected over windows of ADAPTIVE_WINDOW
+// seconds. A mode switch happens after ADAPTIVE_PATIENCE consecutive windows
+// vote for the same other mode. If the first window after a switch is below
+// ADAPTIVE_REVERT times the throughput before it, the switch is undone and no
+// further switch is considered for ADAPTIVE_HOLD windows.
+#define ADAPTIVE_WINDOW 0.05
+#define ADAPTIVE_PATIENCE 3
+#define ADAPTIVE_REVERT 0.8
+#define ADAPTIVE_HOLD 20
+
+// Contention thresholds (fraction of restarted txns or of admitted txns that
+// found a lock taken) below which OCC is preferred and above which LOCKING
+// (write-heavy load) or MVCC (read-heavy load) is.
+#define ADAPTIVE_LOW_CONTENTION 0.05
+#define ADAPTIVE_HIGH_CONTENTION 0.2
+
+// Last TID chosen by the Silo worker running on this thread.
+static thread_local uint64 silo_last_tid = 0;
+
+// Slot (in the owning TxnProcessor's 'mvcc_active_') in which this thread
+// advertises the id of the MVCC txn it is executing.
+static thread_local TxnProcessor *mvcc_slot_owner = NULL;
+static thread_local int mvcc_slot = 0;
+
+// Value of an 'mvcc_active_' slot whose thread is not executing a txn.
+#define MVCC_IDLE_SLOT (~static_cast<uint64>(0))
+
+// Intake queue that the next txn submitted from this thread goes to in DIRECT
+// exec mode. Kept per thread so that submitting clients never share a cursor.
+static thread_local uint32 intake_cursor = 0;
+
+TxnProcessor::TxnProcessor(CCMode mode, ExecMode exec, const ThreadOptions &threads,
+                           const LockOptions &locks)
+    : mode_(mode), exec_(exec),
+      tp_(WorkerCount(threads), threads.affinity_, threads.scheduler_cpu_),
+      thread_count_(tp_.ThreadCount()), stopped_(false), next_unique_id_(1),
+      direct_workers_(NULL), direct_idle_count_(0), direct_execute_(NULL), silo_epoch_(1),
+      silo_next_epoch_(GetTime() + SILO_EPOCH_DURATION),
+      adaptive_mode_(OCC), adaptive_target_(OCC), in_flight_(0), cm_(NULL),
+      window_admitted_(0), window_blocked_(0), window_keys_(0), window_writes_(0),
+      window_start_(GetTime()), adaptive_candidate_(OCC), adaptive_votes_(0),
+      adaptive_prev_mode_(OCC), adaptive_prev_throughput_(0), adaptive_hold_(0),
+      mvcc_active_(new std::atomic<uint64>[thread_count_]), mvcc_slots_claimed_(0),
+      ssi_snapshots_(new std::atomic<uint64>[thread_count_])
 {
+  for (int i = 0; i < thread_count_; i++)
+  {
+    mvcc_active_[i] = MVCC_IDLE_SLOT;
+    ssi_snapshots_[i] = MVCC_IDLE_SLOT;
+  }
+
   if (mode_ == LOCKING_EXCLUSIVE_ONLY)
     lm_ = new LockManagerA(&ready_txns_);
-  else if (mode_ == LOCKING)
+  else if (mode_ == LOCKING || mode_ == ADAPTIVE)
     lm_ = new LockManagerB(&ready_txns_);
+  else if (mode_ == LOCKING_HIERARCHICAL || mode_ == CALVIN)
+  {
+    if (locks.partition_size_ == 0)
+      DIE("Partition size must not be zero");
+    lm_ = new LockManagerC(&ready_txns_, locks.partition_size_,
+                           locks.escalation_threshold_);
+  }
 
-  // Create the storage
-  if (mode_ == MVCC)
+  // Create the storage. ADAPTIVE mode uses MVCC storage for all of the modes
+  // it switches between.
+  if (mode_ == MVCC || mode_ == ADAPTIVE || mode_ == SI || mode_ == SSI)
   {
     storage_ = new MVCCStorage();
   }
+  else if (mode_ == SILO)
+  {
+    storage_ = new SiloStorage();
+  }
+  else if (mode_ == TICTOC)
+  {
+    storage_ = new TicTocStorage();
+  }
   else
   {
     storage_ = new Storage();
@@ -28,18 +107,92 @@ TxnProcessor::TxnProcessor(CCMode mode)
 
   storage_->InitStorage();
 
+  // The restart-based modes back off and cap admission under contention. With
+  // no central scheduler, DIRECT exec mode retries restarted txns right away.
+  if (exec_ == SCHEDULED && (mode_ == OCC || mode_ == P_OCC || mode_ == MVCC ||
+                              mode_ == SI || mode_ == SSI))
+    cm_ = new ContentionManager(CM_MIN_IN_FLIGHT, CM_MAX_IN_FLIGHT);
+
+  SelectTxnPaths();
+
+  if (exec_ == DIRECT)
+  {
+    if (mode_ == P_OCC)
+      direct_execute_ = &TxnProcessor::ExecuteTxnParallel;
+    else if (mode_ == MVCC)
+      direct_execute_ = &TxnProcessor::MVCCExecuteTxn;
+    else if (mode_ == SILO)
+      direct_execute_ = &TxnProcessor::SiloExecuteTxn;
+    else if (mode_ == TICTOC)
+      direct_execute_ = &TxnProcessor::TicTocExecuteTxn;
+    else if (mode_ == SI)
+      direct_execute_ = &TxnProcessor::SIExecuteTxn<false>;
+    else if (mode_ == SSI)
+      direct_execute_ = &TxnProcessor::SIExecuteTxn<true>;
+    else
+      DIE("DIRECT exec mode is not supported by mode " << mode_);
+
+    // Each worker loop owns one pool thread for the processor's lifetime.
+    void (TxnProcessor::*run_worker)(int) = &TxnProcessor::RunDirectWorker<false>;
+    if (mode_ == SILO)
+      run_worker = &TxnProcessor::RunDirectWorker<true>;
+    direct_workers_ = new DirectWorker[thread_count_];
+    for (int i = 0; i < thread_count_; i++)
+      direct_workers_[i].idle_.store(false, std::memory_order_relaxed);
+    for (int i = 0; i < thread_count_; i++)
+    {
+      tp_.RunTaskOn(i, new Method<TxnProcessor, void, int>(this, run_worker, i));
+    }
+    return;
+  }
+
   // Start 'RunScheduler()' running.
-  cpu_set_t cpuset;
   pthread_attr_t attr;
   pthread_attr_init(&attr);
-  CPU_ZERO(&cpuset);
-  for (int i = 0; i < 7; i++)
+  if (threads.scheduler_cpu_ >= CPU_SETSIZE)
+    DIE("Invalid scheduler CPU " << threads.scheduler_cpu_);
+  if (threads.scheduler_cpu_ >= 0)
   {
-    CPU_SET(i, &cpuset);
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(threads.scheduler_cpu_, &cpuset);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
   }
-  pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
-  pthread_t scheduler_;
-  pthread_create(&scheduler_, &attr, StartScheduler, reinterpret_cast<void *>(this));
+  // Fails if the scheduler is pinned to a CPU that is offline or outside the
+  // process's affinity mask.
+  int rc = pthread_create(&scheduler_thread_, &attr, StartScheduler, reinterpret_cast<void *>(this));
+  pthread_attr_destroy(&attr);
+  if (rc != 0)
+    DIE("Could not start the scheduler thread: " << strerror(rc));
+}
+
+int TxnProcessor::WorkerCount(const ThreadOptions &threads)
+{
+  if (threads.worker_count_ > 0)
+    return threads.worker_count_;
+  return std::max(1, CpuTopology().CpuCount());
+}
+
+bool TxnFuture::Ready()
+{
+  mutex_.Lock();
+  bool ready = (txn_ != NULL);
+  mutex_.Unlock();
+  return ready;
+}
+
+Txn *TxnFuture::Wait()
+{
+  ready_.WaitWhileNull(&txn_);
+  return txn_;
+}
+
+void TxnFuture::Run(Txn *txn)
+{
+  // Publish the txn and signal in one critical section: once Ready() or
+  // Wait() sees the txn, the future may be destroyed, so it must not be
+  // touched after the mutex is released.
+  ready_.SetAndSignal(&txn_, txn);
 }
 
 void *TxnProcessor::StartScheduler(void *arg)
@@ -50,35 +203,185 @@ void *TxnProcessor::StartScheduler(void *arg)
 
 TxnProcessor::~TxnProcessor()
 {
-  if (mode_ == LOCKING_EXCLUSIVE_ONLY || mode_ == LOCKING)
+  // Stop the scheduler (or the DIRECT worker loops) first. Only then stop the
+  // pool, so that nothing dispatches to it once it is stopped, and let it
+  // drain the txns already dispatched before tearing down what they use.
+  stopped_.store(true, std::memory_order_release);
+  if (exec_ == SCHEDULED)
+  {
+    pthread_join(scheduler_thread_, NULL);
+  }
+  else
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int i = 0; i < thread_count_; i++)
+      UnparkDirectWorker(i);
+  }
+  tp_.Stop();
+
+  if (mode_ == LOCKING_EXCLUSIVE_ONLY || mode_ == LOCKING ||
+      mode_ == LOCKING_HIERARCHICAL || mode_ == ADAPTIVE || mode_ == CALVIN)
     delete lm_;
 
+  delete cm_;
+  delete[] direct_workers_;
   delete storage_;
+  delete[] mvcc_active_;
+  delete[] ssi_snapshots_;
+  for (uint32 i = 0; i < ssi_committed_.size(); i++)
+    delete ssi_committed_[i];
 }
 
 void TxnProcessor::NewTxnRequest(Txn *txn)
 {
-  // Atomically assign the txn a new number and add it to the incoming txn
-  // requests queue.
-  mutex_.Lock();
-  txn->unique_id_ = next_unique_id_;
-  next_unique_id_++;
-  txn_requests_.Push(txn);
-  mutex_.Unlock();
+  // Assign the txn a new number and add it to the incoming txn requests queue.
+  txn->unique_id_ = next_unique_id_.fetch_add(1);
+  EnqueueTxn(txn);
 }
 
-Txn *TxnProcessor::GetTxnResult()
+void TxnProcessor::NewTxnRequest(Txn *txn, TxnCallback *callback)
 {
-  Txn *txn;
-  while (!txn_results_.Pop(&txn))
+  txn->callback_ = callback;
+  NewTxnRequest(txn);
+}
+
+void TxnProcessor::NewTxnRequests(Txn **txns, size_t n)
+{
+  // Reserve a contiguous block of ids with a single atomic add.
+  uint64 id = next_unique_id_.fetch_add(n);
+  for (size_t i = 0; i < n; i++)
+  {
+    txns[i]->unique_id_ = id + i;
+  }
+
+  (this->*enqueue_txns_)(txns, n);
+}
+
+void TxnProcessor::EnqueueTxn(Txn *txn)
+{
+  (this->*enqueue_txns_)(&txn, 1);
+}
+
+void TxnProcessor::EnqueueScheduledTxns(Txn **txns, size_t n)
+{
+  if (n == 1)
+    txn_requests_.Push(txns[0]);
+  else
+    txn_requests_.PushBatch(txns, n);
+}
+
+void TxnProcessor::EnqueueDirectTxns(Txn **txns, size_t n)
+{
+  if (n == 1)
+  {
+    int worker = intake_cursor++ % thread_count_;
+    direct_workers_[worker].intake_.Push(txns[0]);
+    WakeDirectWorker(worker);
+    return;
+  }
+
+  // Spread the batch over the intake queues in contiguous slices.
+  size_t slice = (n + thread_count_ - 1) / thread_count_;
+  for (size_t i = 0; i < n; i += slice)
+  {
+    int worker = intake_cursor++ % thread_count_;
+    direct_workers_[worker].intake_.PushBatch(txns + i, std::min(slice, n - i));
+    WakeDirectWorker(worker);
+  }
+}
+
+void TxnProcessor::PublishResult(Txn *txn)
+{
+  (this->*publish_result_)(txn);
+}
+
+template <bool kScheduled, bool kBackoff, bool kAdaptive>
+void TxnProcessor::PublishResult(Txn *txn)
+{
+  if (kScheduled)
+    in_flight_--;
+  if (kBackoff)
+    cm_->TxnFinished(txn);
+  if (kAdaptive)
+    window_commits_.Add();
+
+  // The callback may free the txn, so it must not be touched afterwards.
+  if (txn->callback_ != NULL)
+    txn->callback_->Run(txn);
+  else
+    txn_results_.Push(txn);
+}
+
+void TxnProcessor::SelectTxnPaths()
+{
+  if (exec_ == DIRECT)
+  {
+    enqueue_txns_ = &TxnProcessor::EnqueueDirectTxns;
+    publish_result_ = &TxnProcessor::PublishResult<false, false, false>;
+    restart_txn_ = &TxnProcessor::RestartTxn<false, false, false>;
+  }
+  else if (cm_ != NULL)
+  {
+    enqueue_txns_ = &TxnProcessor::EnqueueScheduledTxns;
+    publish_result_ = &TxnProcessor::PublishResult<true, true, false>;
+    restart_txn_ = &TxnProcessor::RestartTxn<true, true, false>;
+  }
+  else if (mode_ == ADAPTIVE)
+  {
+    enqueue_txns_ = &TxnProcessor::EnqueueScheduledTxns;
+    publish_result_ = &TxnProcessor::PublishResult<true, false, true>;
+    restart_txn_ = &TxnProcessor::RestartTxn<true, false, true>;
+  }
+  else
+  {
+    enqueue_txns_ = &TxnProcessor::EnqueueScheduledTxns;
+    publish_result_ = &TxnProcessor::PublishResult<true, false, false>;
+    restart_txn_ = &TxnProcessor::RestartTxn<true, false, false>;
+  }
+
+  // MVCC, SI and SSI read through their own functions, and SILO and TICTOC
+  // also commit through their own. Their storage classes must not be used
+  // through the plain Storage versions, so these paths die in those modes.
+  if (mode_ == ADAPTIVE)
+  {
+    read_keys_ = &TxnProcessor::AdaptiveReadKeys;
+    apply_writes_ = &TxnProcessor::AdaptiveApplyWrites;
+  }
+  else if (mode_ == MVCC || mode_ == SI || mode_ == SSI)
   {
-    // No result yet. Wait a bit before trying again (to reduce contention on
-    // atomic queues).
-    sleep(0.000001);
+    read_keys_ = &TxnProcessor::UnusedTxnPath;
+    apply_writes_ = &TxnProcessor::ApplyWrites<MVCCStorage>;
   }
+  else if (mode_ == SILO || mode_ == TICTOC)
+  {
+    read_keys_ = &TxnProcessor::UnusedTxnPath;
+    apply_writes_ = &TxnProcessor::UnusedTxnPath;
+  }
+  else
+  {
+    read_keys_ = &TxnProcessor::ReadKeys<Storage>;
+    apply_writes_ = &TxnProcessor::ApplyWrites<Storage>;
+  }
+}
+
+void TxnProcessor::UnusedTxnPath(Txn *txn)
+{
+  DIE("Mode " << mode_ << " does not read or write txns through ReadKeys/ApplyWrites");
+}
+
+Txn *TxnProcessor::GetTxnResult(double timeout)
+{
+  Txn *txn;
+  if (!txn_results_.WaitPop(&txn, timeout))
+    return NULL;
   return txn;
 }
 
+size_t TxnProcessor::GetTxnResults(vector<Txn *> *txns, size_t max, double timeout)
+{
+  return txn_results_.WaitPopBatch(txns, max, timeout);
+}
+
 void TxnProcessor::RunScheduler()
 {
   switch (mode_)
@@ -87,29 +390,49 @@ void TxnProcessor::RunScheduler()
     RunSerialScheduler();
     break;
   case LOCKING:
-    RunLockingScheduler();
+    RunLockingScheduler<false>();
     break;
   case LOCKING_EXCLUSIVE_ONLY:
-    RunLockingScheduler();
+    RunLockingScheduler<false>();
+    break;
+  case LOCKING_HIERARCHICAL:
+    RunLockingScheduler<false>();
     break;
   case OCC:
-    RunOCCScheduler();
+    RunOCCScheduler<false>();
+    break;
+  case P_OCC:
+    RunOCCParallelScheduler();
     break;
-  // case P_OCC:
-  //   RunOCCParallelScheduler();
-  //   break;
   case MVCC:
-    RunMVCCScheduler();
+    RunMVCCScheduler<false>();
+    break;
+  case SILO:
+    RunSiloScheduler();
+    break;
+  case TICTOC:
+    RunTicTocScheduler();
+    break;
+  case ADAPTIVE:
+    RunAdaptiveScheduler();
+    break;
+  case CALVIN:
+    RunCalvinScheduler();
+    break;
+  case SI:
+  case SSI:
+    RunSIScheduler();
+    break;
   }
 }
 
 void TxnProcessor::RunSerialScheduler()
 {
   Txn *txn;
-  while (tp_.Active())
+  while (Active())
   {
     // Get next txn request.
-    if (txn_requests_.Pop(&txn))
+    if (AdmitTxn(&txn))
     {
       // Execute txn.
       ExecuteTxn(txn);
@@ -131,74 +454,135 @@ void TxnProcessor::RunSerialScheduler()
       }
 
       // Return result to client.
-      txn_results_.Push(txn);
+      PublishResult(txn);
     }
   }
 }
 
+template <bool kAdaptive>
 void TxnProcessor::RunLockingScheduler()
 {
-  Txn *txn;
-  while (tp_.Active())
+  // Run the scheduler loop specialized for the concrete lock manager type.
+  if (mode_ == LOCKING_EXCLUSIVE_ONLY)
+    RunLockingScheduler<kAdaptive>(static_cast<LockManagerA *>(lm_));
+  else if (mode_ == LOCKING_HIERARCHICAL)
+    RunLockingScheduler<kAdaptive>(static_cast<LockManagerC *>(lm_));
+  else
+    RunLockingScheduler<kAdaptive>(static_cast<LockManagerB *>(lm_));
+}
+
+template <class LockManagerType>
+bool TxnProcessor::LockKeys(LockManagerType *lm, Txn *txn)
+{
+  bool blocked = false;
+
+  // Request read locks.
+  for (KeySet::iterator it = txn->readset_.begin();
+       it != txn->readset_.end(); ++it)
   {
-    // Start processing the next incoming transaction request.
-    if (txn_requests_.Pop(&txn))
+    if (!lm->LockManagerType::ReadLock(txn, *it))
     {
-      bool blocked = false;
-      // Request read locks.
-      for (set<Key>::iterator it = txn->readset_.begin();
-           it != txn->readset_.end(); ++it)
+      blocked = true;
+      // If readset_.size() + writeset_.size() > 1, and blocked, just abort
+      if (txn->readset_.size() + txn->writeset_.size() > 1)
       {
-        if (!lm_->ReadLock(txn, *it))
+        // Release all locks that already acquired
+        for (KeySet::iterator it_reads = txn->readset_.begin(); true; ++it_reads)
         {
-          blocked = true;
-          // If readset_.size() + writeset_.size() > 1, and blocked, just abort
-          if (txn->readset_.size() + txn->writeset_.size() > 1)
+          lm->LockManagerType::Release(txn, *it_reads);
+          if (it_reads == it)
           {
-            // Release all locks that already acquired
-            for (set<Key>::iterator it_reads = txn->readset_.begin(); true; ++it_reads)
-            {
-              lm_->Release(txn, *it_reads);
-              if (it_reads == it)
-              {
-                break;
-              }
-            }
             break;
           }
         }
+        return false;
       }
+    }
+  }
 
-      if (blocked == false)
+  // Request write locks.
+  for (KeySet::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it)
+  {
+    if (!lm->LockManagerType::WriteLock(txn, *it))
+    {
+      blocked = true;
+      // If readset_.size() + writeset_.size() > 1, and blocked, just abort
+      if (txn->readset_.size() + txn->writeset_.size() > 1)
       {
-        // Request write locks.
-        for (set<Key>::iterator it = txn->writeset_.begin();
-             it != txn->writeset_.end(); ++it)
+        // Release all read locks that already acquired
+        for (KeySet::iterator it_reads = txn->readset_.begin(); it_reads != txn->readset_.end(); ++it_reads)
+        {
+          lm->LockManagerType::Release(txn, *it_reads);
+        }
+        // Release all write locks that already acquired
+        for (KeySet::iterator it_writes = txn->writeset_.begin(); true; ++it_writes)
         {
-          if (!lm_->WriteLock(txn, *it))
+          lm->LockManagerType::Release(txn, *it_writes);
+          if (it_writes == it)
           {
-            blocked = true;
-            // If readset_.size() + writeset_.size() > 1, and blocked, just abort
-            if (txn->readset_.size() + txn->writeset_.size() > 1)
-            {
-              // Release all read locks that already acquired
-              for (set<Key>::iterator it_reads = txn->readset_.begin(); it_reads != txn->readset_.end(); ++it_reads)
-              {
-                lm_->Release(txn, *it_reads);
-              }
-              // Release all write locks that already acquired
-              for (set<Key>::iterator it_writes = txn->writeset_.begin(); true; ++it_writes)
-              {
-                lm_->Release(txn, *it_writes);
-                if (it_writes == it)
-                {
-                  break;
-                }
-              }
-              break;
-            }
+            break;
           }
         }
+        return false;
+      }
+    }
+  }
+
+  return !blocked;
+}
+
+bool TxnProcessor::LockKeys(LockManagerC *lm, Txn *txn)
+{
+  // The hierarchical lock manager requests (and possibly escalates) all of
+  // the txn's locks at once.
+  if (lm->LockTxn(txn, txn->readset_, txn->writeset_))
+  {
+    return true;
+  }
+  if (txn->readset_.size() + txn->writeset_.size() > 1)
+  {
+    lm->ReleaseTxn(txn);
+  }
+  return false;
+}
+
+template <class LockManagerType>
+void TxnProcessor::ReleaseKeys(LockManagerType *lm, Txn *txn)
+{
+  // Release read locks.
+  for (KeySet::iterator it = txn->readset_.begin();
+       it != txn->readset_.end(); ++it)
+  {
+    lm->LockManagerType::Release(txn, *it);
+  }
+  // Release write locks.
+  for (KeySet::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it)
+  {
+    lm->LockManagerType::Release(txn, *it);
+  }
+}
+
+void TxnProcessor::ReleaseKeys(LockManagerC *lm, Txn *txn)
+{
+  lm->ReleaseTxn(txn);
+}
+
+template <bool kAdaptive, class LockManagerType>
+void TxnProcessor::RunLockingScheduler(LockManagerType *lm)
+{
+  Txn *txn;
+  while (SchedulerActive<kAdaptive>())
+  {
+    // Start processing the next incoming transaction request.
+    if (AdmitTxn<kAdaptive>(&txn))
+    {
+      bool blocked = !LockKeys(lm, txn);
+
+      if (kAdaptive && blocked)
+      {
+        window_blocked_++;
       }
 
       // If all read and write locks were immediately acquired, this txn is
@@ -209,48 +593,18 @@ void TxnProcessor::RunLockingScheduler()
       }
       else if (blocked == true && (txn->writeset_.size() + txn->readset_.size() > 1))
       {
-        mutex_.Lock();
-        txn->unique_id_ = next_unique_id_;
-        next_unique_id_++;
-        txn_requests_.Push(txn);
-        mutex_.Unlock();
+        RestartTxn(txn);
       }
     }
 
-    // Process and commit all transactions that have finished running.
+    // Release the locks of all transactions that have finished running (and
+    // have already been committed or aborted by their worker).
     while (completed_txns_.Pop(&txn))
     {
-      // Commit/abort txn according to program logic's commit/abort decision.
-      if (txn->Status() == COMPLETED_C)
-      {
-        ApplyWrites(txn);
-        txn->status_ = COMMITTED;
-      }
-      else if (txn->Status() == COMPLETED_A)
-      {
-        txn->status_ = ABORTED;
-      }
-      else
-      {
-        // Invalid TxnStatus!
-        DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
-      }
-
-      // Release read locks.
-      for (set<Key>::iterator it = txn->readset_.begin();
-           it != txn->readset_.end(); ++it)
-      {
-        lm_->Release(txn, *it);
-      }
-      // Release write locks.
-      for (set<Key>::iterator it = txn->writeset_.begin();
-           it != txn->writeset_.end(); ++it)
-      {
-        lm_->Release(txn, *it);
-      }
+      ReleaseKeys(lm, txn);
 
       // Return result to client.
-      txn_results_.Push(txn);
+      PublishResult(txn);
     }
 
     // Start executing all transactions that have newly acquired all their
@@ -262,57 +616,156 @@ void TxnProcessor::RunLockingScheduler()
       ready_txns_.pop_front();
 
       // Start txn running in its own thread.
-      tp_.RunTask(new Method<TxnProcessor, void, Txn *>(
-          this,
-          &TxnProcessor::ExecuteTxn,
-          txn));
+      Dispatch(&TxnProcessor::ExecuteLockedTxn, txn);
     }
   }
 }
 
+void TxnTask::Run()
+{
+  (processor_->*method_)(txn_);
+}
+
+void TxnProcessor::Dispatch(void (TxnProcessor::*method)(Txn *), Txn *txn)
+{
+  txn->task_.processor_ = this;
+  txn->task_.method_ = method;
+  txn->task_.txn_ = txn;
+  tp_.RunTask(&txn->task_);
+}
+
 void TxnProcessor::ExecuteTxn(Txn *txn)
 {
 
   // Get the start time
   txn->occ_start_time_ = GetTime();
 
+  ReadKeys(txn);
+
+  // Execute txn's program logic.
+  txn->Run();
+
+  // Hand the txn back to the RunScheduler thread.
+  completed_txns_.Push(txn);
+}
+
+void TxnProcessor::ExecuteLockedTxn(Txn *txn)
+{
+  ReadKeys(txn);
+  txn->Run();
+
+  // Commit/abort txn according to program logic's commit/abort decision. The
+  // txn still holds exclusive locks on every key it writes.
+  if (txn->Status() == COMPLETED_C)
+  {
+    ApplyWrites(txn);
+    txn->status_ = COMMITTED;
+  }
+  else if (txn->Status() == COMPLETED_A)
+  {
+    txn->status_ = ABORTED;
+  }
+  else
+  {
+    // Invalid TxnStatus!
+    DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+  }
+
+  // Hand the txn back to the RunScheduler thread to release its locks.
+  completed_txns_.Push(txn);
+}
+
+void TxnProcessor::ReadKeys(Txn *txn)
+{
+  (this->*read_keys_)(txn);
+}
+
+void TxnProcessor::AdaptiveReadKeys(Txn *txn)
+{
+  // LOCKING and OCC over MVCC storage read the newest version of each key.
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
+  for (int pass = 0; pass < 2; pass++)
+  {
+    const KeySet &keys = (pass == 0) ? txn->readset_ : txn->writeset_;
+    for (KeySet::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      Value result;
+      storage->Lock(*it);
+      if (storage->ReadLatest(*it, &result))
+        txn->reads_[*it] = result;
+      storage->Unlock(*it);
+    }
+  }
+}
+
+template <class StorageType>
+void TxnProcessor::ReadKeys(Txn *txn)
+{
+  StorageType *storage = static_cast<StorageType *>(storage_);
+
   // Read everything in from readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
+  for (KeySet::iterator it = txn->readset_.begin();
        it != txn->readset_.end(); ++it)
   {
     // Save each read result iff record exists in storage.
     Value result;
-    if (storage_->Read(*it, &result))
+    if (storage->StorageType::Read(*it, &result))
       txn->reads_[*it] = result;
   }
 
   // Also read everything in from writeset.
-  for (set<Key>::iterator it = txn->writeset_.begin();
+  for (KeySet::iterator it = txn->writeset_.begin();
        it != txn->writeset_.end(); ++it)
   {
     // Save each read result iff record exists in storage.
     Value result;
-    if (storage_->Read(*it, &result))
+    if (storage->StorageType::Read(*it, &result))
       txn->reads_[*it] = result;
   }
+}
 
-  // Execute txn's program logic.
-  txn->Run();
+void TxnProcessor::ApplyWrites(Txn *txn)
+{
+  (this->*apply_writes_)(txn);
+}
 
-  // Hand the txn back to the RunScheduler thread.
-  completed_txns_.Push(txn);
+void TxnProcessor::AdaptiveApplyWrites(Txn *txn)
+{
+  // ADAPTIVE's MVCC mode installs writes like MVCC does.
+  if (adaptive_mode_ == MVCC)
+  {
+    ApplyWrites<MVCCStorage>(txn);
+    return;
+  }
+
+  // LOCKING and OCC over MVCC storage install each write as a new version.
+  // Versions are stamped with a fresh id at commit, so the newest version of
+  // a key is always the last one committed.
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
+  uint64 commit_id = next_unique_id_.fetch_add(1);
+  for (KeyValueMap::iterator it = txn->writes_.begin();
+       it != txn->writes_.end(); ++it)
+  {
+    storage->MVCCStorage::Lock(it->first);
+    storage->MVCCStorage::Write(it->first, it->second, commit_id);
+    storage->MVCCStorage::Unlock(it->first);
+  }
 }
 
+template <class StorageType>
 void TxnProcessor::ApplyWrites(Txn *txn)
 {
+  StorageType *storage = static_cast<StorageType *>(storage_);
+
   // Write buffered writes out to storage.
-  for (map<Key, Value>::iterator it = txn->writes_.begin();
+  for (KeyValueMap::iterator it = txn->writes_.begin();
        it != txn->writes_.end(); ++it)
   {
-    storage_->Write(it->first, it->second, txn->unique_id_);
+    storage->StorageType::Write(it->first, it->second, txn->unique_id_);
   }
 }
 
+template <bool kAdaptive>
 void TxnProcessor::RunOCCScheduler()
 {
   // Commit/restart
@@ -325,12 +778,12 @@ void TxnProcessor::RunOCCScheduler()
   //   txn_requests_.Push(txn);
   //   mutex_.Unlock();
 
-  while (tp_.Active())
+  while (SchedulerActive<kAdaptive>())
   {
     Txn *txn;
-    if (txn_requests_.Pop(&txn))
+    if (AdmitTxn<kAdaptive>(&txn))
     {
-      this->tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::ExecuteTxn, txn));
+      Dispatch(&TxnProcessor::ExecuteTxn, txn);
     }
 
     Txn *finished_txn;
@@ -349,7 +802,7 @@ void TxnProcessor::RunOCCScheduler()
       {
         ApplyWrites(finished_txn);
         finished_txn->status_ = COMMITTED;
-        txn_results_.Push(finished_txn);
+        PublishResult(finished_txn);
       }
     }
   }
@@ -359,26 +812,46 @@ void TxnProcessor::CleanupTxn(Txn *txn)
 {
   txn->reads_.clear();
   txn->writes_.clear();
+  txn->read_writeset_.clear();
+  txn->read_versions_.clear();
+  txn->read_rts_.clear();
   txn->status_ = INCOMPLETE;
 }
 
 void TxnProcessor::RestartTxn(Txn *txn)
 {
-  mutex_.Lock();
-  txn->unique_id_ = next_unique_id_;
-  next_unique_id_++;
-  txn_requests_.Push(txn);
-  mutex_.Unlock();
+  (this->*restart_txn_)(txn);
 }
 
-void TxnProcessor::ValidateTxn(Txn *txn)
+template <bool kScheduled, bool kBackoff, bool kAdaptive>
+void TxnProcessor::RestartTxn(Txn *txn)
 {
-  // Check if it has been aborted from the start.
-  if (txn->status_ == COMPLETED_A)
+  txn->restarts_++;
+  if (kScheduled)
+    in_flight_--;
+  if (kAdaptive)
+    window_restarts_.Add();
+
+  // The contention manager re-admits the txn (with a new id) once its backoff
+  // delay has passed.
+  if (kBackoff)
   {
+    cm_->TxnRestarted(txn);
     return;
   }
-  // Check if the readset is still valid, if not abort
+
+  txn->unique_id_ = next_unique_id_.fetch_add(1);
+  EnqueueTxn(txn);
+}
+
+void TxnProcessor::ValidateTxn(Txn *txn)
+{
+  // Check if it has been aborted from the start.
+  if (txn->status_ == COMPLETED_A)
+  {
+    return;
+  }
+  // Check if the readset is still valid, if not abort
   for (auto it = txn->readset_.begin(); it != txn->readset_.end(); ++it)
   {
     if (txn->occ_start_time_ < storage_->Timestamp(*it))
@@ -403,10 +876,100 @@ void TxnProcessor::ValidateTxn(Txn *txn)
 
 void TxnProcessor::RunOCCParallelScheduler()
 {
-  // NOT IMPLEMENTED FOR THIS TUBES
-  RunSerialScheduler();
+  // Validation and commit happen in the execution threads, so the scheduler
+  // only has to admit requests. Workers hand restarted txns to the contention
+  // manager (see RestartTxn()), which AdmitTxn() re-admits after their backoff.
+  while (Active())
+  {
+    Txn *txn;
+    if (AdmitTxn(&txn))
+    {
+      Dispatch(&TxnProcessor::ExecuteTxnParallel, txn);
+    }
+  }
 }
 
+void TxnProcessor::ExecuteTxnParallel(Txn *txn)
+{
+  // Read phase.
+  txn->occ_start_time_ = GetTime();
+  ReadKeys(txn);
+  txn->Run();
+
+  // The txn logic voted to abort, nothing to validate.
+  if (txn->Status() == COMPLETED_A)
+  {
+    txn->status_ = ABORTED;
+    PublishResult(txn);
+    return;
+  }
+
+  // Take a snapshot of the txns currently validating and join them, then
+  // check against the snapshot outside the lock, so that txns validate in
+  // parallel. Each txn in the snapshot stays pinned until it has been checked,
+  // so that it is not handed back to the client (and freed) in the meantime.
+  vector<Txn *> active;
+  active_set_mutex_.Lock();
+  active.assign(active_set_.begin(), active_set_.end());
+  for (uint32 i = 0; i < active.size(); i++)
+    active[i]->occ_pins_.fetch_add(1, std::memory_order_relaxed);
+  active_set_.insert(txn);
+  active_set_mutex_.Unlock();
+
+  bool valid = true;
+  for (uint32 i = 0; i < active.size(); i++)
+  {
+    for (KeySet::iterator it = active[i]->writeset_.begin();
+         valid && it != active[i]->writeset_.end(); ++it)
+    {
+      if (txn->readset_.count(*it) || txn->writeset_.count(*it))
+        valid = false;
+    }
+    active[i]->occ_pins_.fetch_sub(1, std::memory_order_release);
+  }
+
+  // Validate against the txns that committed since this txn started. Any txn
+  // that left the active set before we joined it has already applied its
+  // writes, so its timestamps are visible here.
+  for (KeySet::iterator it = txn->readset_.begin();
+       valid && it != txn->readset_.end(); ++it)
+  {
+    if (txn->occ_start_time_ < storage_->Timestamp(*it))
+      valid = false;
+  }
+  for (KeySet::iterator it = txn->writeset_.begin();
+       valid && it != txn->writeset_.end(); ++it)
+  {
+    if (txn->occ_start_time_ < storage_->Timestamp(*it))
+      valid = false;
+  }
+
+  if (valid)
+  {
+    ApplyWrites(txn);
+  }
+
+  // Leave the active set. Txns that joined before now are done with it once
+  // they have unpinned it; later ones can no longer see it.
+  active_set_mutex_.Lock();
+  active_set_.erase(txn);
+  active_set_mutex_.Unlock();
+  while (txn->occ_pins_.load(std::memory_order_acquire) > 0)
+    CpuRelax();
+
+  if (valid)
+  {
+    txn->status_ = COMMITTED;
+    PublishResult(txn);
+  }
+  else
+  {
+    CleanupTxn(txn);
+    RestartTxn(txn);
+  }
+}
+
+template <bool kAdaptive>
 void TxnProcessor::RunMVCCScheduler()
 {
   //
@@ -414,12 +977,12 @@ void TxnProcessor::RunMVCCScheduler()
 
   // Hint:Pop a txn from txn_requests_, and pass it to a thread to execute.
   // Note that you may need to create another execute method, like TxnProcessor::MVCCExecuteTxn.
-  while (tp_.Active())
+  while (SchedulerActive<kAdaptive>())
   {
     Txn *txn;
-    if (txn_requests_.Pop(&txn))
+    if (AdmitTxn<kAdaptive>(&txn))
     {
-      this->tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::MVCCExecuteTxn, txn));
+      Dispatch(&TxnProcessor::MVCCExecuteTxn, txn);
     }
   }
 }
@@ -430,7 +993,8 @@ void TxnProcessor::MVCCExecuteTxn(Txn *txn)
   // Read all necessary data for this transaction from storage (Note that unlike the version of MVCC from class, you should lock the key before each read)
   // Execute the transaction logic (i.e. call Run() on the transaction)
   // Acquire all locks for keys in the write_set_
-  // Call MVCCStorage::CheckWrite method to check all keys in the write_set_
+  // Drop the writes if they are already obsolete (Thomas write rule), or else
+  // call MVCCStorage::CheckWrite method to check all keys in the write_set_
   // If (each key passed the check)
   //   Apply the writes
   //   Release all locks for keys in the write_set_
@@ -439,55 +1003,348 @@ void TxnProcessor::MVCCExecuteTxn(Txn *txn)
   //   Cleanup txn
   //   Completely restart the transaction.
 
+  if (txn->writeset_.empty())
+  {
+    MVCCExecuteReadOnlyTxn(txn);
+    return;
+  }
+
+  // Take the txn's timestamp when it starts executing, and advertise it in
+  // this thread's slot until the txn is done so that MVCCWatermark() stays
+  // below it. The slot is set to a lower bound of the id first, so that a
+  // concurrent MVCCWatermark() either sees the slot or started before the id
+  // was handed out.
+  std::atomic<uint64> *slot = MVCCActiveSlot();
+  slot->store(next_unique_id_.load());
+  txn->unique_id_ = next_unique_id_.fetch_add(1);
+  slot->store(txn->unique_id_);
+
   MVCCReadKeys(txn);
   txn->Run();
   MVCCLockWriteKeys(txn);
-  if (MVCCCheckWrites(txn))
+  bool obsolete = MVCCWritesObsolete(txn);
+  if (obsolete || MVCCCheckWrites(txn))
   {
-    ApplyWrites(txn);
+    if (!obsolete)
+      ApplyWrites(txn);
     MVCCUnlockWriteKeys(txn);
+    slot->store(MVCC_IDLE_SLOT);
     txn->status_ = COMMITTED;
-    txn_results_.Push(txn);
+    PublishResult(txn);
   }
   else
   {
     MVCCUnlockWriteKeys(txn);
+    slot->store(MVCC_IDLE_SLOT);
+    CleanupTxn(txn);
+    RestartTxn(txn);
+  }
+}
+
+void TxnProcessor::RunSIScheduler()
+{
+  void (TxnProcessor::*execute)(Txn *) = &TxnProcessor::SIExecuteTxn<false>;
+  if (mode_ == SSI)
+    execute = &TxnProcessor::SIExecuteTxn<true>;
+  while (Active())
+  {
+    Txn *txn;
+    if (AdmitTxn(&txn))
+    {
+      Dispatch(execute, txn);
+    }
+  }
+}
+
+template <bool kSerializable>
+void TxnProcessor::SIExecuteTxn(Txn *txn)
+{
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
+
+  // Read everything from a stable snapshot, without latches. Under SSI, the
+  // snapshot is advertised (see SSICollect()), starting with a placeholder
+  // that keeps every SSI record alive until the snapshot is known.
+  std::atomic<uint64> *running = NULL;
+  if (kSerializable)
+  {
+    running = SSISnapshotSlot();
+    running->store(0);
+  }
+  uint64 snapshot = MVCCWatermark();
+  if (kSerializable)
+    running->store(snapshot);
+  for (int pass = 0; pass < 2; pass++)
+  {
+    const KeySet &keys = (pass == 0) ? txn->readset_ : txn->writeset_;
+    for (KeySet::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      Value result;
+      if (storage->ReadSnapshot(*it, &result, snapshot))
+        txn->reads_[*it] = result;
+    }
+  }
+
+  txn->Run();
+
+  // Txns whose logic aborted are done. So are read-only txns under SI, as a
+  // snapshot is a consistent view on its own. Under SSI their reads still
+  // count as rw-antidependencies.
+  if (txn->Status() == COMPLETED_A || (!kSerializable && txn->writeset_.empty()))
+  {
+    if (kSerializable)
+      running->store(MVCC_IDLE_SLOT);
+    txn->status_ = (txn->Status() == COMPLETED_A) ? ABORTED : COMMITTED;
+    PublishResult(txn);
+    return;
+  }
+
+  // Lock the write keys in key order, so that committers never deadlock.
+  bool valid = true;
+  for (KeySet::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it)
+  {
+    storage->Lock(*it);
+    if (storage->ChangedSince(*it, snapshot))
+      valid = false;
+  }
+
+  if (valid && kSerializable)
+  {
+    ssi_mutex_.Lock();
+    valid = SSICommit(txn, snapshot);
+    ssi_mutex_.Unlock();
+  }
+  else if (valid)
+  {
+    // Install the writes under a fresh commit id, advertised like an MVCC
+    // txn's id so that no snapshot includes a partially installed commit.
+    std::atomic<uint64> *slot = MVCCActiveSlot();
+    slot->store(next_unique_id_.load());
+    txn->unique_id_ = next_unique_id_.fetch_add(1);
+    slot->store(txn->unique_id_);
+    ApplyWrites(txn);
+    slot->store(MVCC_IDLE_SLOT);
+  }
+
+  for (KeySet::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it)
+  {
+    storage->Unlock(*it);
+  }
+  if (kSerializable)
+    running->store(MVCC_IDLE_SLOT);
+
+  if (valid)
+  {
+    txn->status_ = COMMITTED;
+    PublishResult(txn);
+  }
+  else
+  {
     CleanupTxn(txn);
     RestartTxn(txn);
   }
 }
 
+bool TxnProcessor::SSICommit(Txn *txn, uint64 snapshot)
+{
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
+  vector<SSITxn *> writers;
+  vector<SSITxn *> readers;
+
+  // txn -rw-> W for every W that wrote a key txn read after its snapshot. If W
+  // already has an outgoing edge, it would become a committed pivot.
+  vector<int> versions;
+  for (KeySet::iterator it = txn->readset_.begin();
+       it != txn->readset_.end(); ++it)
+  {
+    versions.clear();
+    storage->VersionsSince(*it, snapshot, &versions);
+    for (uint32 i = 0; i < versions.size(); i++)
+    {
+      map<uint64, SSITxn *>::iterator writer = ssi_writers_.find(versions[i]);
+      if (writer == ssi_writers_.end())
+        continue;
+      if (writer->second->out_conflict_)
+        return false;
+      writers.push_back(writer->second);
+    }
+  }
+
+  // R -rw-> txn for every overlapping R that read a key txn writes. If R
+  // already has an incoming edge, it would become a committed pivot.
+  for (KeySet::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it)
+  {
+    unordered_map<Key, deque<SSITxn *> >::iterator list = ssi_readers_.find(*it);
+    if (list == ssi_readers_.end())
+      continue;
+    for (deque<SSITxn *>::iterator reader = list->second.begin();
+         reader != list->second.end(); ++reader)
+    {
+      if ((*reader)->commit_id_ <= snapshot)
+        continue;
+      if ((*reader)->in_conflict_)
+        return false;
+      readers.push_back(*reader);
+    }
+  }
+
+  // With edges both ways, txn itself would be the pivot.
+  if (!writers.empty() && !readers.empty())
+    return false;
+
+  SSITxn *record = new SSITxn();
+  record->reads_.assign(txn->readset_.begin(), txn->readset_.end());
+  record->in_conflict_ = !readers.empty();
+  record->out_conflict_ = !writers.empty();
+  if (txn->writeset_.empty())
+  {
+    record->commit_id_ = next_unique_id_.load();
+  }
+  else
+  {
+    // Install the writes as in SI (see SIExecuteTxn()).
+    std::atomic<uint64> *slot = MVCCActiveSlot();
+    slot->store(next_unique_id_.load());
+    txn->unique_id_ = next_unique_id_.fetch_add(1);
+    slot->store(txn->unique_id_);
+    ApplyWrites(txn);
+    slot->store(MVCC_IDLE_SLOT);
+    record->commit_id_ = txn->unique_id_;
+    ssi_writers_[record->commit_id_] = record;
+  }
+
+  for (uint32 i = 0; i < writers.size(); i++)
+    writers[i]->in_conflict_ = true;
+  for (uint32 i = 0; i < readers.size(); i++)
+    readers[i]->out_conflict_ = true;
+  for (uint32 i = 0; i < record->reads_.size(); i++)
+    ssi_readers_[record->reads_[i]].push_back(record);
+  ssi_committed_.push_back(record);
+
+  SSICollect();
+  return true;
+}
+
+void TxnProcessor::SSICollect()
+{
+  // A txn overlaps a record if its snapshot is older than the record's commit
+  // id. Snapshots still to be taken are at least the current watermark.
+  uint64 oldest = MVCCWatermark();
+  for (int i = 0; i < thread_count_; i++)
+    oldest = std::min(oldest, ssi_snapshots_[i].load());
+
+  // Records are kept in commit order, both here and per key.
+  while (!ssi_committed_.empty() && ssi_committed_.front()->commit_id_ <= oldest)
+  {
+    SSITxn *record = ssi_committed_.front();
+    ssi_committed_.pop_front();
+    map<uint64, SSITxn *>::iterator writer = ssi_writers_.find(record->commit_id_);
+    if (writer != ssi_writers_.end() && writer->second == record)
+      ssi_writers_.erase(writer);
+    for (uint32 i = 0; i < record->reads_.size(); i++)
+    {
+      deque<SSITxn *> &readers = ssi_readers_[record->reads_[i]];
+      readers.pop_front();
+      if (readers.empty())
+        ssi_readers_.erase(record->reads_[i]);
+    }
+    delete record;
+  }
+}
+
+std::atomic<uint64> *TxnProcessor::SSISnapshotSlot()
+{
+  MVCCActiveSlot();
+  return &ssi_snapshots_[mvcc_slot];
+}
+
+void TxnProcessor::MVCCExecuteReadOnlyTxn(Txn *txn)
+{
+  // Every txn that could still install a version visible at the watermark has
+  // finished, so the snapshot is stable: reads need no latches, and they are
+  // not registered in max_read_id_, so no writer ever aborts because of them.
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
+  uint64 snapshot = MVCCWatermark();
+  for (KeySet::iterator it = txn->readset_.begin(); it != txn->readset_.end(); ++it)
+  {
+    Value result;
+    if (storage->ReadSnapshot(*it, &result, snapshot))
+      txn->reads_[*it] = result;
+  }
+
+  txn->Run();
+  txn->status_ = (txn->Status() == COMPLETED_A) ? ABORTED : COMMITTED;
+  PublishResult(txn);
+}
+
+std::atomic<uint64> *TxnProcessor::MVCCActiveSlot()
+{
+  if (mvcc_slot_owner != this)
+  {
+    mvcc_slot_owner = this;
+    mvcc_slot = mvcc_slots_claimed_++;
+    if (mvcc_slot >= thread_count_)
+      DIE("More MVCC execution threads than active slots.");
+  }
+  return &mvcc_active_[mvcc_slot];
+}
+
+uint64 TxnProcessor::MVCCWatermark()
+{
+  // Read the next id before the slots: a txn that is not yet visible in its
+  // slot will get an id of at least 'watermark'.
+  uint64 watermark = next_unique_id_.load();
+  for (int i = 0; i < thread_count_; i++)
+  {
+    watermark = std::min(watermark, mvcc_active_[i].load());
+  }
+  return watermark - 1;
+}
+
 void TxnProcessor::MVCCReadKeys(Txn *txn)
 {
   // Inside your Execution method of MVCC:  when you call read() method to read values from database,
   // please don't forget to provide the third parameter(txn->unique_id_), otherwise the default value is 0 and you always read the oldest version.
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
   for (auto &e : txn->readset_)
   {
-    storage_->Lock(e);
+    storage->MVCCStorage::Lock(e);
     Value result;
-    if (storage_->Read(e, &result, txn->unique_id_))
+    if (storage->MVCCStorage::Read(e, &result, txn->unique_id_))
     {
       txn->reads_[e] = result;
     }
-    storage_->Unlock(e);
+    storage->MVCCStorage::Unlock(e);
   }
 
+  // Writeset keys the logic does not read are written blind, so their reads
+  // are only registered at commit (see MVCCCheckWrites()).
   for (auto &e : txn->writeset_)
   {
-    storage_->Lock(e);
+    storage->MVCCStorage::Lock(e);
     Value result;
-    if (storage_->Read(e, &result, txn->unique_id_))
+    int version_id;
+    if (storage->Peek(e, &result, &version_id, txn->unique_id_))
     {
       txn->reads_[e] = result;
     }
-    storage_->Unlock(e);
+    txn->read_versions_[e] = version_id;
+    storage->MVCCStorage::Unlock(e);
   }
 }
 bool TxnProcessor::MVCCCheckWrites(Txn *txn)
 {
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
   for (auto &e : txn->writeset_)
   {
-    if (!(storage_->CheckWrite(e, txn->unique_id_)))
+    if (txn->read_writeset_.count(e) &&
+        !storage->RegisterRead(e, static_cast<int>(txn->read_versions_[e]), txn->unique_id_))
+    {
+      return false;
+    }
+    if (!(storage->MVCCStorage::CheckWrite(e, txn->unique_id_)))
     {
       return false;
     }
@@ -495,18 +1352,541 @@ bool TxnProcessor::MVCCCheckWrites(Txn *txn)
   return true;
 }
 
+bool TxnProcessor::MVCCWritesObsolete(Txn *txn)
+{
+  // The txn can then be serialized right before the txn that overwrote it:
+  // every txn with a smaller id still sees the old values, and every other txn
+  // sees the newer ones.
+  if (!txn->readset_.empty() || !txn->read_writeset_.empty() || txn->writes_.empty())
+  {
+    return false;
+  }
+
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
+  int successor = -1;
+  for (KeyValueMap::iterator it = txn->writes_.begin(); it != txn->writes_.end(); ++it)
+  {
+    int id;
+    if (!storage->Superseded(it->first, txn->unique_id_, &id) ||
+        (successor != -1 && id != successor))
+    {
+      return false;
+    }
+    successor = id;
+  }
+  return true;
+}
+
 void TxnProcessor::MVCCLockWriteKeys(Txn *txn)
 {
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
   for (auto &e : txn->writeset_)
   {
-    storage_->Lock(e);
+    storage->MVCCStorage::Lock(e);
   }
 }
 
 void TxnProcessor::MVCCUnlockWriteKeys(Txn *txn)
 {
+  MVCCStorage *storage = static_cast<MVCCStorage *>(storage_);
   for (auto &e : txn->writeset_)
   {
-    storage_->Unlock(e);
+    storage->MVCCStorage::Unlock(e);
+  }
+}
+
+void TxnProcessor::AdvanceSiloEpoch()
+{
+  // Workers only read the epoch when they commit. Of several threads that
+  // see the deadline pass, only the one that moves it forward advances.
+  double next = silo_next_epoch_.load(std::memory_order_relaxed);
+  if (GetTime() >= next &&
+      silo_next_epoch_.compare_exchange_strong(next, next + SILO_EPOCH_DURATION))
+    silo_epoch_++;
+}
+
+void TxnProcessor::RunSiloScheduler()
+{
+  while (Active())
+  {
+    AdvanceSiloEpoch();
+
+    Txn *txn;
+    if (AdmitTxn(&txn))
+    {
+      Dispatch(&TxnProcessor::SiloExecuteTxn, txn);
+    }
+  }
+}
+
+void TxnProcessor::SiloExecuteTxn(Txn *txn)
+{
+  SiloStorage *storage = static_cast<SiloStorage *>(storage_);
+
+  // Read phase: remember the TID of every record read.
+  for (KeySet::iterator it = txn->readset_.begin(); it != txn->readset_.end(); ++it)
+  {
+    Value result;
+    if (storage->StableRead(*it, &result, &txn->read_versions_[*it]))
+      txn->reads_[*it] = result;
+  }
+  for (KeySet::iterator it = txn->writeset_.begin(); it != txn->writeset_.end(); ++it)
+  {
+    Value result;
+    if (storage->StableRead(*it, &result, &txn->read_versions_[*it]))
+      txn->reads_[*it] = result;
+  }
+
+  txn->Run();
+
+  if (txn->Status() == COMPLETED_A)
+  {
+    txn->status_ = ABORTED;
+    PublishResult(txn);
+    return;
+  }
+
+  // Phase 1: lock the write set. writeset_ is sorted, so all workers lock in
+  // the same key order and can not deadlock.
+  for (KeySet::iterator it = txn->writeset_.begin(); it != txn->writeset_.end(); ++it)
+  {
+    storage->LockRecord(*it);
+  }
+
+  // Serialization point.
+  uint64 epoch = silo_epoch_.load();
+
+  // Phase 2: validate the read set. A record read by the txn must still
+  // have the same TID, and must not be locked by some other txn.
+  bool valid = true;
+  uint64 max_tid = silo_last_tid;
+  for (KeySet::iterator it = txn->readset_.begin(); valid && it != txn->readset_.end(); ++it)
+  {
+    uint64 tid = txn->read_versions_[*it];
+    valid = storage->RecordTid(*it) == tid;
+    max_tid = std::max(max_tid, tid);
+  }
+  for (KeySet::iterator it = txn->writeset_.begin(); valid && it != txn->writeset_.end(); ++it)
+  {
+    uint64 tid = txn->read_versions_[*it];
+    valid = (storage->RecordTid(*it) & ~SiloStorage::kLockBit) == tid;
+    max_tid = std::max(max_tid, tid);
+  }
+
+  if (!valid)
+  {
+    for (KeySet::iterator it = txn->writeset_.begin(); it != txn->writeset_.end(); ++it)
+    {
+      storage->UnlockRecord(*it);
+    }
+    CleanupTxn(txn);
+    RestartTxn(txn);
+    return;
+  }
+
+  // Phase 3: pick a TID larger than every TID the txn observed and than this
+  // worker's previous TID, in the current epoch, then install the writes.
+  uint64 tid = max_tid + SiloStorage::MakeTid(0, 1);
+  if (SiloStorage::TidEpoch(tid) < epoch)
+    tid = SiloStorage::MakeTid(epoch, 1);
+  silo_last_tid = tid;
+
+  for (KeySet::iterator it = txn->writeset_.begin(); it != txn->writeset_.end(); ++it)
+  {
+    KeyValueMap::iterator write = txn->writes_.find(*it);
+    if (write != txn->writes_.end())
+      storage->InstallAndUnlock(*it, write->second, tid);
+    else
+      storage->UnlockRecord(*it);
+  }
+
+  txn->status_ = COMMITTED;
+  PublishResult(txn);
+}
+
+void TxnProcessor::RunTicTocScheduler()
+{
+  while (Active())
+  {
+    Txn *txn;
+    if (AdmitTxn(&txn))
+    {
+      Dispatch(&TxnProcessor::TicTocExecuteTxn, txn);
+    }
+  }
+}
+
+void TxnProcessor::TicTocExecuteTxn(Txn *txn)
+{
+  TicTocStorage *storage = static_cast<TicTocStorage *>(storage_);
+
+  // Read phase: remember the range [wts, rts] in which each value read is
+  // valid.
+  for (KeySet::iterator it = txn->readset_.begin(); it != txn->readset_.end(); ++it)
+  {
+    Value result;
+    if (storage->StableRead(*it, &result, &txn->read_versions_[*it], &txn->read_rts_[*it]))
+      txn->reads_[*it] = result;
+  }
+  for (KeySet::iterator it = txn->writeset_.begin(); it != txn->writeset_.end(); ++it)
+  {
+    Value result;
+    if (storage->StableRead(*it, &result, &txn->read_versions_[*it], &txn->read_rts_[*it]))
+      txn->reads_[*it] = result;
+  }
+
+  txn->Run();
+
+  if (txn->Status() == COMPLETED_A)
+  {
+    txn->status_ = ABORTED;
+    PublishResult(txn);
+    return;
+  }
+
+  // Lock the write set in key order.
+  for (KeySet::iterator it = txn->writeset_.begin(); it != txn->writeset_.end(); ++it)
+  {
+    storage->LockRecord(*it);
+  }
+
+  // The commit timestamp is the earliest logical time at which every value
+  // read is still valid and every record written can be overwritten.
+  uint64 commit_ts = 0;
+  for (KeySet::iterator it = txn->readset_.begin(); it != txn->readset_.end(); ++it)
+  {
+    commit_ts = std::max(commit_ts, txn->read_versions_[*it]);
+  }
+  for (KeySet::iterator it = txn->writeset_.begin(); it != txn->writeset_.end(); ++it)
+  {
+    commit_ts = std::max(commit_ts, storage->LockedRts(*it) + 1);
+  }
+
+  // The records in the write set must not have changed since they were read.
+  bool valid = true;
+  for (KeySet::iterator it = txn->writeset_.begin(); valid && it != txn->writeset_.end(); ++it)
+  {
+    valid = storage->LockedWts(*it) == txn->read_versions_[*it];
+  }
+
+  // Values read that are not known to be valid at commit_ts must still be
+  // current, in which case their validity is extended up to commit_ts.
+  for (KeySet::iterator it = txn->readset_.begin(); valid && it != txn->readset_.end(); ++it)
+  {
+    if (txn->read_rts_[*it] >= commit_ts || txn->reads_.count(*it) == 0)
+      continue;
+
+    // The record is being written by some other txn.
+    if (!storage->TryLockRecord(*it))
+    {
+      valid = false;
+      break;
+    }
+    if (storage->LockedWts(*it) == txn->read_versions_[*it])
+      storage->ExtendRts(*it, commit_ts);
+    else
+      valid = false;
+    storage->UnlockRecord(*it);
+  }
+
+  for (KeySet::iterator it = txn->writeset_.begin(); it != txn->writeset_.end(); ++it)
+  {
+    KeyValueMap::iterator write = txn->writes_.find(*it);
+    if (valid && write != txn->writes_.end())
+      storage->InstallAndUnlock(*it, write->second, commit_ts);
+    else
+      storage->UnlockRecord(*it);
+  }
+
+  if (valid)
+  {
+    txn->status_ = COMMITTED;
+    PublishResult(txn);
+  }
+  else
+  {
+    CleanupTxn(txn);
+    RestartTxn(txn);
+  }
+}
+
+template <bool kSilo>
+void TxnProcessor::RunDirectWorker(int worker)
+{
+  Txn *txn;
+  while (Active())
+  {
+    if (NextDirectTxn(worker, &txn) || DirectIdle(worker, &txn))
+    {
+      // With no scheduler thread, the workers keep the Silo epoch moving.
+      if (kSilo)
+        AdvanceSiloEpoch();
+      (this->*direct_execute_)(txn);
+    }
+  }
+}
+
+bool TxnProcessor::NextDirectTxn(int worker, Txn **txn)
+{
+  // Drain our own intake queue first, then help out the other workers.
+  for (int i = 0; i < thread_count_; i++)
+  {
+    if (direct_workers_[(worker + i) % thread_count_].intake_.PopNonBlocking(txn))
+      return true;
+  }
+  return false;
+}
+
+bool TxnProcessor::DirectIdle(int worker, Txn **txn)
+{
+  // Same protocol as the idle threads of StaticThreadPool.
+  for (int round = 0; round < DIRECT_SPIN_ROUNDS; round++)
+  {
+    for (int i = 0; i < DIRECT_PAUSES_PER_ROUND; i++)
+      CpuRelax();
+    if (NextDirectTxn(worker, txn))
+      return true;
+    if (!Active())
+      return false;
+  }
+
+  // Announce that we are about to park, then look once more. Submitters
+  // publish their txn before checking for parked workers, so either we see
+  // the txn here or they see us and wake us up.
+  DirectWorker *self = &direct_workers_[worker];
+  self->idle_.store(true, std::memory_order_relaxed);
+  direct_idle_count_.fetch_add(1, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  bool found = NextDirectTxn(worker, txn);
+  if (!found && Active())
+    self->parker_.Park();
+  if (self->idle_.exchange(false, std::memory_order_acq_rel))
+    direct_idle_count_.fetch_sub(1, std::memory_order_relaxed);
+  return found;
+}
+
+void TxnProcessor::WakeDirectWorker(int worker)
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  // Acquire, so that the idle_ flags of the counted workers are visible.
+  if (direct_idle_count_.load(std::memory_order_acquire) == 0)
+    return;
+  for (int i = 0; i < thread_count_; i++)
+  {
+    if (UnparkDirectWorker((worker + i) % thread_count_))
+      return;
+  }
+}
+
+bool TxnProcessor::UnparkDirectWorker(int worker)
+{
+  DirectWorker *target = &direct_workers_[worker];
+  if (!target->idle_.load(std::memory_order_relaxed) ||
+      !target->idle_.exchange(false, std::memory_order_acq_rel))
+    return false;
+  direct_idle_count_.fetch_sub(1, std::memory_order_relaxed);
+  target->parker_.Unpark();
+  return true;
+}
+
+void TxnProcessor::RunAdaptiveScheduler()
+{
+  while (Active())
+  {
+    switch (adaptive_mode_)
+    {
+    case LOCKING:
+      RunLockingScheduler<true>();
+      break;
+    case OCC:
+      RunOCCScheduler<true>();
+      break;
+    case MVCC:
+      RunMVCCScheduler<true>();
+      break;
+    default:
+      DIE("Invalid ADAPTIVE mode: " << adaptive_mode_);
+    }
+
+    // The scheduler returned because a switch was pending and every admitted
+    // txn has finished (or because the processor is shutting down). No txn is
+    // executing, so the next mode starts from a clean slate.
+    adaptive_mode_ = adaptive_target_;
+    window_commits_.Take();
+    window_restarts_.Take();
+    window_admitted_ = window_blocked_ = window_keys_ = window_writes_ = 0;
+    window_start_ = GetTime();
+  }
+}
+
+bool TxnProcessor::Active()
+{
+  return !stopped_.load(std::memory_order_acquire);
+}
+
+template <bool kAdaptive>
+bool TxnProcessor::SchedulerActive()
+{
+  if (!Active())
+    return false;
+  if (!kAdaptive)
+    return true;
+
+  AdaptiveTick();
+  return adaptive_target_ == adaptive_mode_ || in_flight_ > 0;
+}
+
+template <bool kAdaptive>
+bool TxnProcessor::AdmitTxn(Txn **txn)
+{
+  // Stop admitting while waiting for an ADAPTIVE switch to quiesce.
+  if (kAdaptive && adaptive_target_ != adaptive_mode_)
+    return false;
+
+  if (cm_ != NULL)
+  {
+    if (!cm_->NextTxn(&txn_requests_, in_flight_, txn))
+      return false;
+    if ((*txn)->restarts_ > 0)
+      (*txn)->unique_id_ = next_unique_id_.fetch_add(1);
+  }
+  else if (!txn_requests_.Pop(txn))
+  {
+    return false;
+  }
+
+  in_flight_++;
+  if (!kAdaptive)
+    return true;
+
+  (*txn)->unique_id_ = next_unique_id_.fetch_add(1);
+  window_admitted_++;
+  window_keys_ += (*txn)->readset_.size() + (*txn)->writeset_.size();
+  window_writes_ += (*txn)->writeset_.size();
+  return true;
+}
+
+void TxnProcessor::AdaptiveTick()
+{
+  double now = GetTime();
+  if (now < window_start_ + ADAPTIVE_WINDOW || adaptive_target_ != adaptive_mode_)
+    return;
+
+  uint64 commits = window_commits_.Take();
+  uint64 restarts = window_restarts_.Take();
+  double throughput = commits / (now - window_start_);
+  double restart_rate = (commits + restarts > 0) ? static_cast<double>(restarts) / (commits + restarts) : 0;
+  double block_rate = (window_admitted_ > 0) ? static_cast<double>(window_blocked_) / window_admitted_ : 0;
+  double write_ratio = (window_keys_ > 0) ? static_cast<double>(window_writes_) / window_keys_ : 0;
+  bool idle = (window_admitted_ == 0 && commits == 0);
+  window_admitted_ = window_blocked_ = window_keys_ = window_writes_ = 0;
+  window_start_ = now;
+
+  if (idle)
+    return;
+
+  CCMode mode = adaptive_mode_;
+
+  // Judge the first window after a switch against the window before it.
+  if (adaptive_prev_throughput_ > 0)
+  {
+    bool worse = throughput < ADAPTIVE_REVERT * adaptive_prev_throughput_;
+    adaptive_prev_throughput_ = 0;
+    if (worse)
+    {
+      adaptive_target_ = adaptive_prev_mode_;
+      adaptive_hold_ = ADAPTIVE_HOLD;
+      adaptive_votes_ = 0;
+      return;
+    }
+  }
+
+  if (adaptive_hold_ > 0)
+  {
+    adaptive_hold_--;
+    return;
+  }
+
+  // Vote for the mode that suits this window's load.
+  double contention = std::max(restart_rate, block_rate);
+  CCMode vote = mode;
+  if (contention < ADAPTIVE_LOW_CONTENTION)
+    vote = OCC;
+  else if (contention > ADAPTIVE_HIGH_CONTENTION)
+    vote = (write_ratio >= 0.5) ? LOCKING : MVCC;
+
+  if (vote == mode)
+  {
+    adaptive_votes_ = 0;
+    return;
+  }
+  if (vote != adaptive_candidate_)
+  {
+    adaptive_candidate_ = vote;
+    adaptive_votes_ = 0;
+  }
+  if (++adaptive_votes_ >= ADAPTIVE_PATIENCE)
+  {
+    adaptive_prev_mode_ = mode;
+    adaptive_prev_throughput_ = throughput;
+    adaptive_target_ = vote;
+    adaptive_votes_ = 0;
+  }
+}
+
+void TxnProcessor::RunCalvinScheduler()
+{
+  LockManagerC *lm = static_cast<LockManagerC *>(lm_);
+  vector<Txn *> batch;
+  double epoch_end = GetTime() + CALVIN_EPOCH_DURATION;
+  Txn *txn;
+  while (Active())
+  {
+    // Collect requests into the current epoch's batch.
+    while (AdmitTxn(&txn))
+    {
+      batch.push_back(txn);
+    }
+
+    if (GetTime() >= epoch_end)
+    {
+      epoch_end += CALVIN_EPOCH_DURATION;
+
+      // Fix the batch's order and restamp it with consecutive ids, so the
+      // ids give the global serial order (and a batch can be replayed from
+      // its txns alone).
+      std::sort(batch.begin(), batch.end(),
+                [](Txn *a, Txn *b) { return a->unique_id_ < b->unique_id_; });
+      uint64 id = next_unique_id_.fetch_add(batch.size());
+      for (uint32 i = 0; i < batch.size(); i++)
+      {
+        batch[i]->unique_id_ = id + i;
+      }
+
+      // Lock the batch in order. Txns whose locks are not all granted wait in
+      // the lock manager, which moves them to 'ready_txns_' once they are.
+      for (uint32 i = 0; i < batch.size(); i++)
+      {
+        if (lm->LockTxn(batch[i], batch[i]->readset_, batch[i]->writeset_))
+          ready_txns_.push_back(batch[i]);
+      }
+      batch.clear();
+    }
+
+    // Release the locks of finished txns, which their workers have already
+    // committed (or aborted, as the program logic decided).
+    while (completed_txns_.Pop(&txn))
+    {
+      lm->ReleaseTxn(txn);
+      PublishResult(txn);
+    }
+
+    // Start executing all txns that hold all of their locks.
+    while (ready_txns_.size())
+    {
+      txn = ready_txns_.front();
+      ready_txns_.pop_front();
+      Dispatch(&TxnProcessor::ExecuteLockedTxn, txn);
+    }
   }
 }
@@ -2,44 +2,150 @@
 #ifndef _TXN_PROCESSOR_H_
 #define _TXN_PROCESSOR_H_
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "txn/common.h"
+#include "txn/contention_manager.h"
 #include "txn/lock_manager.h"
 #include "txn/storage.h"
 #include "txn/mvcc_storage.h"
+#include "txn/silo_storage.h"
+#include "txn/tictoc_storage.h"
 #include "txn/txn.h"
 #include "utils/atomic.h"
+#include "utils/cpu_topology.h"
 #include "utils/static_thread_pool.h"
 #include "utils/mutex.h"
+#include "utils/parker.h"
 #include "utils/condition.h"
 
 using std::deque;
 using std::map;
 using std::string;
+using std::vector;
 
-// The TxnProcessor supports five different execution modes, corresponding to
-// the four parts of assignment 2, plus a simple serial (non-concurrent) mode.
+// The TxnProcessor supports thirteen different execution modes, corresponding
+// to the five parts of assignment 2, a simple serial (non-concurrent) mode,
+// multi-granularity locking, Silo-style OCC, TicToc, a mode that switches
+// between LOCKING, OCC and MVCC at runtime, Calvin-style deterministic batch
+// locking, and snapshot isolation (plain and serializable).
 enum CCMode
 {
   SERIAL = 0,                 // Serial transaction execution (no concurrency)
   LOCKING_EXCLUSIVE_ONLY = 1, // Part 1A
   LOCKING = 2,                // Part 1B
   OCC = 3,                    // Part 2
-  MVCC = 4,
+  P_OCC = 4,                  // Part 3
+  MVCC = 5,                   // Part 4
+  LOCKING_HIERARCHICAL = 6,   // Intention locks over key partitions
+  SILO = 7,                   // Decentralized OCC with per-record TID words
+  TICTOC = 8,                 // OCC with lazily computed commit timestamps
+  ADAPTIVE = 9,               // LOCKING, OCC or MVCC, chosen from the load
+  CALVIN = 10,                // Epoch batches locked in a deterministic order
+  SI = 11,                    // Snapshot isolation, first committer wins
+  SSI = 12,                   // SI that also aborts on rw-antidependencies
+};
+
+// How transactions are handed to the execution threads.
+enum ExecMode
+{
+  SCHEDULED = 0, // A central scheduler thread dispatches every txn
+  DIRECT = 1,    // Workers pull txns from per-worker intake queues
+};
+
+// Number and placement of a TxnProcessor's threads.
+struct ThreadOptions
+{
+  ThreadOptions() : worker_count_(0), scheduler_cpu_(-1), affinity_(AFFINITY_NONE) {}
+
+  // Number of worker threads. If not positive, one per CPU the process may
+  // run on.
+  int worker_count_;
+
+  // CPU the scheduler thread is pinned to, or -1 to leave it unpinned. Workers
+  // placed by an affinity policy stay off this CPU.
+  int scheduler_cpu_;
+
+  // How worker threads are pinned to the CPUs (see utils/cpu_topology.h).
+  AffinityPolicy affinity_;
+};
+
+// Lock granularity of the modes that lock key partitions
+// (LOCKING_HIERARCHICAL and CALVIN).
+struct LockOptions
+{
+  LockOptions() : partition_size_(1000), escalation_threshold_(16) {}
+
+  // Number of consecutive keys covered by one partition lock. Must not
+  // be zero.
+  uint64 partition_size_;
+
+  // Number of keys a txn may lock individually before LOCKING_HIERARCHICAL
+  // escalates it to partition locks.
+  int escalation_threshold_;
 };
 
 // Returns a human-readable string naming of the providing mode.
 string ModeToString(CCMode mode);
 
+// Receives the result of a single txn request. 'Run' is called exactly once,
+// from the thread that commits or aborts the txn, and takes ownership of the
+// txn. The callback itself stays owned by the caller.
+class TxnCallback
+{
+public:
+  virtual ~TxnCallback() {}
+  virtual void Run(Txn *txn) = 0;
+};
+
+// A TxnCallback that a client can wait on, e.g.
+//
+//   TxnFuture future;
+//   processor->NewTxnRequest(txn, &future);
+//   ...
+//   Txn *result = future.Wait();
+class TxnFuture : public TxnCallback
+{
+public:
+  TxnFuture() : txn_(NULL), ready_(&mutex_) {}
+
+  // Returns true if the txn has committed or aborted.
+  bool Ready();
+
+  // Sleeps until the txn has committed or aborted, then returns it. The caller
+  // takes ownership of the returned Txn.
+  Txn *Wait();
+
+  virtual void Run(Txn *txn);
+
+private:
+  Txn *txn_;
+  Mutex mutex_;
+  Condition ready_;
+};
+
 class TxnProcessor
 {
 public:
   // The TxnProcessor's constructor starts the TxnProcessor running in the
   // background.
-  explicit TxnProcessor(CCMode mode);
+  //
+  // In DIRECT exec mode no scheduler thread is started: each worker thread
+  // pulls requests from its own intake queue (stealing from the others when
+  // it runs dry) and runs the whole txn lifecycle itself. Only modes that
+  // already validate and commit on the worker threads (P_OCC, MVCC, SILO,
+  // TICTOC, SI and SSI) support DIRECT.
+  //
+  // 'threads' sets the number of worker threads and where they and the
+  // scheduler thread run. 'locks' sets the lock granularity of the modes that
+  // lock key partitions.
+  explicit TxnProcessor(CCMode mode, ExecMode exec = SCHEDULED,
+                        const ThreadOptions &threads = ThreadOptions(),
+                        const LockOptions &locks = LockOptions());
 
   // The TxnProcessor's destructor stops all background threads and deallocates
   // all objects currently owned by the TxnProcessor, except for Txn objects.
@@ -49,9 +155,26 @@ public:
   // Ownership of '*txn' is transfered to the TxnProcessor.
   void NewTxnRequest(Txn *txn);
 
+  // Like 'NewTxnRequest(txn)', but the result is handed to '*callback' (see
+  // TxnCallback) instead of being returned by GetTxnResult.
+  void NewTxnRequest(Txn *txn, TxnCallback *callback);
+
+  // Registers 'n' new txn requests at once. The txns get consecutive
+  // unique_ids and are enqueued in a single queue operation (per intake queue
+  // in DIRECT exec mode). Ownership of the txns is transfered to the
+  // TxnProcessor.
+  void NewTxnRequests(Txn **txns, size_t n);
+
   // Returns a pointer to the next COMMITTED or ABORTED Txn. The caller takes
-  // ownership of the returned Txn.
-  Txn *GetTxnResult();
+  // ownership of the returned Txn. Sleeps until a result is available; if
+  // 'timeout' is non-negative, returns NULL once 'timeout' seconds have passed
+  // without one.
+  Txn *GetTxnResult(double timeout = -1);
+
+  // Waits for results like 'GetTxnResult(timeout)', then appends up to 'max'
+  // of them to '*txns' at once. Returns the number of results appended (0 only
+  // on timeout). The caller takes ownership of the returned Txns.
+  size_t GetTxnResults(vector<Txn *> *txns, size_t max, double timeout = -1);
 
   // Main loop implementing all concurrency control/thread scheduling.
   void RunScheduler();
@@ -59,6 +182,9 @@ public:
   static void *StartScheduler(void *arg);
 
 private:
+  // Returns the number of worker threads to start for 'threads'.
+  static int WorkerCount(const ThreadOptions &threads);
+
   // Serial validation
   bool SerialValidate(Txn *txn);
 
@@ -68,37 +194,243 @@ private:
   // Serial version of scheduler.
   void RunSerialScheduler();
 
-  // Locking version of scheduler.
+  // Locking version of scheduler. Runs the loop below for the concrete type of
+  // 'lm_'. Like the OCC and MVCC schedulers, it takes kAdaptive = true when
+  // run by the ADAPTIVE scheduler, which compiles in the metrics and
+  // switching logic.
+  template <bool kAdaptive>
   void RunLockingScheduler();
 
+  // Locking scheduler loop. The lock manager is called through its concrete
+  // type rather than through the LockManager interface.
+  template <bool kAdaptive, class LockManagerType>
+  void RunLockingScheduler(LockManagerType *lm);
+
+  // Requests all of the txn's locks. Returns true if they were all granted.
+  // Otherwise the txn either waits for its single lock, or (if it requested
+  // more than one) has released all of its locks again and must be restarted.
+  template <class LockManagerType>
+  bool LockKeys(LockManagerType *lm, Txn *txn);
+  bool LockKeys(LockManagerC *lm, Txn *txn);
+
+  // Releases all of the txn's locks.
+  template <class LockManagerType>
+  void ReleaseKeys(LockManagerType *lm, Txn *txn);
+  void ReleaseKeys(LockManagerC *lm, Txn *txn);
+
   // OCC version of scheduler.
+  template <bool kAdaptive>
   void RunOCCScheduler();
 
   // OCC version of scheduler with parallel validation.
   void RunOCCParallelScheduler();
 
   // MVCC version of scheduler.
+  template <bool kAdaptive>
   void RunMVCCScheduler();
 
+  // Runs 'method' on 'txn' in the thread pool, using the txn's embedded task.
+  //
+  // Requires: the txn is not queued in the pool already.
+  void Dispatch(void (TxnProcessor::*method)(Txn *), Txn *txn);
+
   // Performs all reads required to execute the transaction, then executes the
   // transaction logic.
   void ExecuteTxn(Txn *txn);
 
+  // Like ExecuteTxn, but also commits (or aborts) the transaction, for modes
+  // in which it holds locks on all of its keys while it runs. The scheduler
+  // is then only left to release the locks.
+  void ExecuteLockedTxn(Txn *txn);
+
+  // Reads every key in the txn's readset and writeset into 'txn->reads_'.
+  void ReadKeys(Txn *txn);
+
   // Applies all writes performed by '*txn' to 'storage_'.
   //
   // Requires: txn->Status() is COMPLETED_C.
   void ApplyWrites(Txn *txn);
 
+  // Versions of ReadKeys and ApplyWrites for 'storage_' of concrete type
+  // StorageType, whose methods they call directly instead of virtually.
+  template <class StorageType>
+  void ReadKeys(Txn *txn);
+  template <class StorageType>
+  void ApplyWrites(Txn *txn);
+
+  // Versions of ReadKeys and ApplyWrites for ADAPTIVE mode, in which LOCKING
+  // and OCC run over MVCC storage: they read the newest version of each key
+  // and install each write as a new version.
+  void AdaptiveReadKeys(Txn *txn);
+  void AdaptiveApplyWrites(Txn *txn);
+
   // The following functions are for MVCC
   void MVCCExecuteTxn(Txn *txn);
   void MVCCReadKeys(Txn *txn);
 
   bool MVCCCheckWrites(Txn *txn);
 
+  // Returns true if 'txn' wrote blind, read nothing, and every one of its
+  // writes has already been overwritten by the same later txn, so that its
+  // writes can be dropped (Thomas write rule).
+  //
+  // Requires: the txn's write keys are locked.
+  bool MVCCWritesObsolete(Txn *txn);
+
   void MVCCLockWriteKeys(Txn *txn);
 
   void MVCCUnlockWriteKeys(Txn *txn);
 
+  // SI and SSI version of scheduler.
+  void RunSIScheduler();
+
+  // Executes a txn against a snapshot at MVCCWatermark(), then validates and
+  // commits (or restarts) it. A txn restarts if a key it writes got a new
+  // version since its snapshot (first committer wins). Under SSI
+  // (kSerializable), the txn must also pass SSICommit(), read-only txns
+  // included.
+  template <bool kSerializable>
+  void SIExecuteTxn(Txn *txn);
+
+  // Tracks the rw-antidependencies between 'txn', which read snapshot
+  // 'snapshot', and the committed txns that overlap it, in the style of Cahill
+  // et al.'s serializable SI. An edge T1 -rw-> T2 means that T1 read a key
+  // without seeing T2's write of it. Returns false if committing 'txn' would
+  // leave a txn with both an incoming and an outgoing edge (a possible pivot
+  // of a non-serializable cycle). Otherwise installs the writes of 'txn',
+  // records its edges and returns true.
+  //
+  // Requires: 'ssi_mutex_' is held, and so are the locks of the txn's write
+  // keys.
+  bool SSICommit(Txn *txn, uint64 snapshot);
+
+  // Frees the records of committed SSI txns that no running or future txn
+  // overlaps.
+  //
+  // Requires: 'ssi_mutex_' is held.
+  void SSICollect();
+
+  // Returns the calling thread's slot in 'ssi_snapshots_'.
+  std::atomic<uint64> *SSISnapshotSlot();
+
+  // Executes a txn with an empty writeset against a snapshot at
+  // MVCCWatermark(), without latching or registering its reads.
+  void MVCCExecuteReadOnlyTxn(Txn *txn);
+
+  // Returns the calling thread's slot in 'mvcc_active_', claiming one on first
+  // use.
+  std::atomic<uint64> *MVCCActiveSlot();
+
+  // Returns an id such that no MVCC txn with a smaller or equal id is still
+  // executing (or will ever execute).
+  uint64 MVCCWatermark();
+
+  // Silo version of scheduler. Only hands out txns and advances the epoch.
+  void RunSiloScheduler();
+
+  // Executes, validates and commits (or restarts) a txn using Silo's
+  // commit protocol.
+  void SiloExecuteTxn(Txn *txn);
+
+  // TicToc version of scheduler.
+  void RunTicTocScheduler();
+
+  // Executes a txn, then computes its commit timestamp from the records it
+  // accessed and validates/commits (or restarts) it.
+  void TicTocExecuteTxn(Txn *txn);
+
+  // Calvin version of scheduler. Collects requests into epochs of
+  // CALVIN_EPOCH_DURATION, orders each batch deterministically and requests
+  // the locks of the whole batch in that order. Txns wait for their locks
+  // instead of restarting; since every lock queue is ordered by the global
+  // txn order, waiting can never deadlock.
+  void RunCalvinScheduler();
+
+  // ADAPTIVE version of scheduler. Runs the scheduler of the current mode
+  // until a switch is due and every admitted txn has finished, then switches.
+  void RunAdaptiveScheduler();
+
+  // Returns false once the processor is being destroyed. The scheduler and
+  // the DIRECT worker loops exit when it does.
+  bool Active();
+
+  // Loop condition for the LOCKING, OCC and MVCC schedulers. Besides checking
+  // that the processor is running, in ADAPTIVE mode (kAdaptive) it closes the
+  // current metrics window and returns false once a pending switch has
+  // quiesced.
+  template <bool kAdaptive = false>
+  bool SchedulerActive();
+
+  // Pops the next txn request into '*txn' if there is one and it may be
+  // admitted. With a contention manager, restarted txns are admitted once
+  // their backoff delay has passed and admission is capped. In ADAPTIVE mode
+  // (kAdaptive) no txns are admitted while a switch is pending, and admitted
+  // txns are restamped so that they order after every version installed under
+  // the previous mode.
+  template <bool kAdaptive = false>
+  bool AdmitTxn(Txn **txn);
+
+  // Closes the current ADAPTIVE metrics window if it has run for
+  // ADAPTIVE_WINDOW seconds, and decides whether to switch modes.
+  void AdaptiveTick();
+
+  // Worker loop used in DIRECT exec mode. Runs on pool thread 'worker' until
+  // the processor is stopped. With kSilo, it also advances the Silo epoch.
+  template <bool kSilo>
+  void RunDirectWorker(int worker);
+
+  // Pops the next txn for DIRECT worker 'worker' into '*txn': from its own
+  // intake queue, or else from another worker's. Returns false if all intake
+  // queues are empty.
+  bool NextDirectTxn(int worker, Txn **txn);
+
+  // Called when DIRECT worker 'worker' found no work. Spins for a while, then
+  // parks until a txn is submitted or the processor is stopped. Returns true
+  // with '*txn' set if work turned up.
+  bool DirectIdle(int worker, Txn **txn);
+
+  // Wakes up DIRECT worker 'worker' if it is parked, else some other parked
+  // worker, to pick up a txn just pushed onto the intake queue of 'worker'.
+  void WakeDirectWorker(int worker);
+
+  // Wakes up DIRECT worker 'worker' if it is parked. Returns true if it was.
+  //
+  // Requires: the work meant for it was published, followed by a seq_cst
+  // fence.
+  bool UnparkDirectWorker(int worker);
+
+  // Advances the Silo epoch if SILO_EPOCH_DURATION has passed since the last
+  // advance. Safe to call from any number of threads at once.
+  void AdvanceSiloEpoch();
+
+  // Hands a COMMITTED or ABORTED txn back to the client: to its callback if
+  // it has one, else to 'txn_results_'.
+  void PublishResult(Txn *txn);
+
+  // Hands a new or restarted txn to the execution threads: the scheduler's
+  // request queue in SCHEDULED mode, an intake queue in DIRECT mode.
+  void EnqueueTxn(Txn *txn);
+
+  // Versions of EnqueueTxn for each exec mode, for 'n' txns at once.
+  void EnqueueScheduledTxns(Txn **txns, size_t n);
+  void EnqueueDirectTxns(Txn **txns, size_t n);
+
+  // Versions of PublishResult and RestartTxn for SCHEDULED exec mode
+  // (kScheduled), with a contention manager (kBackoff), and for ADAPTIVE mode
+  // (kAdaptive).
+  template <bool kScheduled, bool kBackoff, bool kAdaptive>
+  void PublishResult(Txn *txn);
+  template <bool kScheduled, bool kBackoff, bool kAdaptive>
+  void RestartTxn(Txn *txn);
+
+  // Points the per-txn function pointers below at the versions of the above
+  // for 'mode_', 'exec_' and 'cm_'.
+  void SelectTxnPaths();
+
+  // Installed by SelectTxnPaths() for the paths that 'mode_' must not take.
+  // Dies.
+  void UnusedTxnPath(Txn *txn);
+
   void GarbageCollection();
   void CleanupTxn(Txn *txn);
   void RestartTxn(Txn *txn);
@@ -106,19 +438,57 @@ private:
   // Concurrency control mechanism the TxnProcessor is currently using.
   CCMode mode_;
 
+  // How txns reach the execution threads.
+  ExecMode exec_;
+
   // Thread pool managing all threads used by TxnProcessor.
   StaticThreadPool tp_;
 
+  // Number of threads in 'tp_'.
+  int thread_count_;
+
+  // Set by the destructor, before 'tp_' is stopped.
+  std::atomic<bool> stopped_;
+
   // Data storage used for all modes.
   Storage *storage_;
 
-  // Next valid unique_id, and a mutex to guard incoming txn requests.
-  int next_unique_id_;
-  Mutex mutex_;
+  // Next valid unique_id. Ids are handed out with fetch_add, so new requests
+  // and restarts never serialize on a lock.
+  std::atomic<uint64> next_unique_id_;
 
   // Queue of incoming transaction requests.
   AtomicQueue<Txn *> txn_requests_;
 
+  // Per-worker state in DIRECT exec mode: an intake queue used instead of
+  // 'txn_requests_', and what the worker parks on when it finds no work. A
+  // worker sets 'idle_' just before parking; whoever clears it wakes it up.
+  struct DirectWorker
+  {
+    AtomicQueue<Txn *> intake_;
+    std::atomic<bool> idle_;
+    Parker parker_;
+  };
+  DirectWorker *direct_workers_;
+
+  // Number of DIRECT workers whose 'idle_' flag is set.
+  std::atomic<int> direct_idle_count_;
+
+  // The worker-side execute method that the intake queues feed.
+  void (TxnProcessor::*direct_execute_)(Txn *txn);
+
+  // Versions of EnqueueTxn, PublishResult, RestartTxn, ReadKeys and
+  // ApplyWrites for this processor's modes (see SelectTxnPaths()), so that
+  // these per-txn paths do not branch on 'mode_' and 'exec_'.
+  void (TxnProcessor::*enqueue_txns_)(Txn **txns, size_t n);
+  void (TxnProcessor::*publish_result_)(Txn *txn);
+  void (TxnProcessor::*restart_txn_)(Txn *txn);
+  void (TxnProcessor::*read_keys_)(Txn *txn);
+  void (TxnProcessor::*apply_writes_)(Txn *txn);
+
+  // Scheduler thread (SCHEDULED exec mode only).
+  pthread_t scheduler_thread_;
+
   // Queue of txns that have acquired all locks and are ready to be executed.
   //
   // Does not need to be atomic because RunScheduler is the only thread that
@@ -133,14 +503,88 @@ private:
   AtomicQueue<Txn *> txn_results_;
 
   // Set of transactions that are currently in the process of parallel
-  // validation.
-  AtomicSet<Txn *> active_set_;
-
-  // Used it for critical section in parallel occ.
+  // validation. Guarded by 'active_set_mutex_'.
+  set<Txn *> active_set_;
   Mutex active_set_mutex_;
 
   // Lock Manager used for LOCKING concurrency implementations.
   LockManager *lm_;
+
+  // Current Silo epoch. Advanced every SILO_EPOCH_DURATION by the scheduler,
+  // only read on the commit path.
+  std::atomic<uint64> silo_epoch_;
+
+  // Time at which the Silo epoch is next advanced. Whoever moves it forward
+  // advances the epoch.
+  std::atomic<double> silo_next_epoch_;
+
+  // ADAPTIVE mode: the mode currently in use, and the mode to switch to once
+  // all admitted txns have finished (equal to 'adaptive_mode_' when no switch
+  // is pending).
+  std::atomic<CCMode> adaptive_mode_;
+  CCMode adaptive_target_;
+
+  // Number of admitted txns that have not yet been published or restarted
+  // (SCHEDULED exec mode only).
+  std::atomic<int> in_flight_;
+
+  // Backoff and admission control for restarted txns (OCC, P_OCC and MVCC in
+  // SCHEDULED exec mode; NULL otherwise).
+  ContentionManager *cm_;
+
+  // ADAPTIVE mode metrics for the current window. Commits and restarts are
+  // counted by whichever thread finishes the txn, the rest by the scheduler.
+  ShardedCounter window_commits_;
+  ShardedCounter window_restarts_;
+  uint64 window_admitted_;
+  uint64 window_blocked_;
+  uint64 window_keys_;
+  uint64 window_writes_;
+  double window_start_;
+
+  // ADAPTIVE mode switch decision state (scheduler thread only): the mode
+  // that the last windows voted for and how many windows in a row did so, the
+  // mode and throughput before the last switch (to revert a switch that made
+  // things worse), and the number of windows to wait before switching again.
+  CCMode adaptive_candidate_;
+  int adaptive_votes_;
+  CCMode adaptive_prev_mode_;
+  double adaptive_prev_throughput_;
+  int adaptive_hold_;
+
+  // MVCC: one slot per execution thread, holding (a lower bound of) the id of
+  // the txn the thread is executing, or MVCC_IDLE_SLOT.
+  std::atomic<uint64> *mvcc_active_;
+  std::atomic<int> mvcc_slots_claimed_;
+
+  // SSI: what is kept of a committed txn while txns that overlap it may still
+  // commit. Overlapping txns are those whose snapshot is older than
+  // 'commit_id_'. Read-only txns get the next unused id as 'commit_id_'.
+  struct SSITxn
+  {
+    uint64 commit_id_;
+    vector<Key> reads_;
+    bool in_conflict_;  // Has an edge from an overlapping txn.
+    bool out_conflict_; // Has an edge to an overlapping txn.
+  };
+
+  // Guards the SSI records below. The SSI commit decision and the writes it
+  // allows are made while holding it.
+  Mutex ssi_mutex_;
+
+  // Committed SSI txns with writes, by commit id.
+  map<uint64, SSITxn *> ssi_writers_;
+
+  // Committed SSI txns that read each key, in commit order.
+  unordered_map<Key, deque<SSITxn *> > ssi_readers_;
+
+  // All committed SSI txns that are still kept, in commit order.
+  deque<SSITxn *> ssi_committed_;
+
+  // One slot per execution thread (indexed like 'mvcc_active_'), holding the
+  // snapshot of the SSI txn the thread is executing, 0 while it takes one, or
+  // MVCC_IDLE_SLOT.
+  std::atomic<uint64> *ssi_snapshots_;
 };
 
 #endif // _TXN_PROCESSOR_H_
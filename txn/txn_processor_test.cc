@@ -1,11 +1,23 @@
 
 #include "txn/txn_processor.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include <vector>
 
+#include "txn/txn_pool.h"
 #include "txn/txn_types.h"
 #include "utils/testing.h"
 
+// Thread placement of the benchmarked TxnProcessors, set from the command line.
+ThreadOptions thread_options;
+
+// Lock granularity of the benchmarked TxnProcessors, set from the command line.
+LockOptions lock_options;
+
+// Whether to run the throughput benchmark after the tests, set by --benchmark.
+bool run_benchmark = false;
+
 // Returns a human-readable string naming of the providing mode.
 string ModeToString(CCMode mode)
 {
@@ -19,19 +31,793 @@ string ModeToString(CCMode mode)
     return " Locking B";
   case OCC:
     return " OCC      ";
-  // case P_OCC:                  return " OCC-P    ";
+  case P_OCC:
+    return " OCC-P    ";
   case MVCC:
     return " MVCC     ";
+  case LOCKING_HIERARCHICAL:
+    return " Locking H";
+  case SILO:
+    return " Silo     ";
+  case TICTOC:
+    return " TicToc   ";
+  case ADAPTIVE:
+    return " Adaptive ";
+  case CALVIN:
+    return " Calvin   ";
+  case SI:
+    return " SI       ";
+  case SSI:
+    return " SSI      ";
   default:
     return "INVALID MODE";
   }
 }
 
+// Returns thread options for the tests: a few workers, whatever the machine.
+ThreadOptions TestThreads()
+{
+  ThreadOptions threads;
+  threads.worker_count_ = 4;
+  return threads;
+}
+
+// Counts the txns it is handed, then deletes them.
+class CountingCallback : public TxnCallback
+{
+public:
+  virtual void Run(Txn *txn)
+  {
+    if (txn->Status() == COMMITTED)
+      ++committed_;
+    else
+      ++aborted_;
+    delete txn;
+  }
+
+  // Sleeps until 'n' txns have been handed over, or 10 seconds have passed.
+  void WaitFor(int n)
+  {
+    double deadline = GetTime() + 10;
+    while (*committed_ + *aborted_ < n && GetTime() < deadline)
+      usleep(1000);
+  }
+
+  Atomic<int> committed_;
+  Atomic<int> aborted_;
+};
+
+// Moves one unit from key 'from' to key 'to', so that the sum over all keys
+// never changes. Yields halfway through to let other txns interleave.
+class Transfer : public Txn
+{
+public:
+  Transfer(Key from, Key to) : from_(from), to_(to)
+  {
+    writeset_.insert(from);
+    writeset_.insert(to);
+  }
+
+  Transfer *clone() const
+  {
+    Transfer *clone = new Transfer(from_, to_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    Value from, to;
+    if (!Read(from_, &from) || !Read(to_, &to))
+      ABORT;
+    sched_yield();
+    Write(from_, from - 1);
+    Write(to_, to + 1);
+    COMMIT;
+  }
+
+private:
+  Key from_;
+  Key to_;
+};
+
+// Reads keys [0, n) and records their sum in 'sum_'.
+class Audit : public Txn
+{
+public:
+  explicit Audit(int n) : n_(n), sum_(0)
+  {
+    for (int i = 0; i < n; i++)
+      readset_.insert(i);
+  }
+
+  Audit *clone() const
+  {
+    Audit *clone = new Audit(n_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    Value value;
+    sum_ = 0;
+    for (KeySet::iterator it = readset_.begin(); it != readset_.end(); ++it)
+    {
+      if (!Read(*it, &value))
+        ABORT;
+      sum_ += value;
+      sched_yield();
+    }
+    COMMIT;
+  }
+
+  int n_;
+  Value sum_;
+};
+
+// Takes one unit from key 'own' if 'own' and 'other' together hold at least
+// two, so that in any serializable execution the pair never drops below one.
+// After its reads it waits (for up to a second) until '*arrived' reaches two,
+// so that two Withdraws from the same pair both read before either writes.
+class Withdraw : public Txn
+{
+public:
+  Withdraw(Key own, Key other, std::atomic<int> *arrived)
+      : own_(own), other_(other), arrived_(arrived)
+  {
+    readset_.insert(other);
+    writeset_.insert(own);
+  }
+
+  Withdraw *clone() const
+  {
+    Withdraw *clone = new Withdraw(own_, other_, arrived_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    Value own, other;
+    if (!Read(own_, &own) || !Read(other_, &other))
+      ABORT;
+    (*arrived_)++;
+    double deadline = GetTime() + 1;
+    while (*arrived_ < 2 && GetTime() < deadline)
+      sched_yield();
+    if (own + other < 2)
+      ABORT;
+    Write(own_, own - 1);
+    COMMIT;
+  }
+
+private:
+  Key own_;
+  Key other_;
+  std::atomic<int> *arrived_;
+};
+
+// Like Put, but first sets '*started' and then waits (for up to ten seconds)
+// until '*open' is set, so that other txns can overtake it.
+class GatedPut : public Txn
+{
+public:
+  GatedPut(const map<Key, Value> &m, std::atomic<bool> *started,
+           std::atomic<bool> *open)
+      : m_(m), started_(started), open_(open)
+  {
+    for (map<Key, Value>::iterator it = m_.begin(); it != m_.end(); ++it)
+      writeset_.insert(it->first);
+  }
+
+  GatedPut *clone() const
+  {
+    GatedPut *clone = new GatedPut(m_, started_, open_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    *started_ = true;
+    double deadline = GetTime() + 10;
+    while (!*open_ && GetTime() < deadline)
+      sched_yield();
+    for (map<Key, Value>::iterator it = m_.begin(); it != m_.end(); ++it)
+      Write(it->first, it->second);
+    COMMIT;
+  }
+
+private:
+  map<Key, Value> m_;
+  std::atomic<bool> *started_;
+  std::atomic<bool> *open_;
+};
+
+// Reads key 'from', sets '*started' and waits (for up to ten seconds) until
+// '*open' is set, then writes the value it read to key 'to'.
+class GatedCopy : public Txn
+{
+public:
+  GatedCopy(Key from, Key to, std::atomic<bool> *started,
+            std::atomic<bool> *open)
+      : from_(from), to_(to), started_(started), open_(open)
+  {
+    readset_.insert(from);
+    writeset_.insert(to);
+  }
+
+  GatedCopy *clone() const
+  {
+    GatedCopy *clone = new GatedCopy(from_, to_, started_, open_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    Value value;
+    if (!Read(from_, &value))
+      ABORT;
+    *started_ = true;
+    double deadline = GetTime() + 10;
+    while (!*open_ && GetTime() < deadline)
+      sched_yield();
+    Write(to_, value);
+    COMMIT;
+  }
+
+private:
+  Key from_;
+  Key to_;
+  std::atomic<bool> *started_;
+  std::atomic<bool> *open_;
+};
+
+// Runs 'txn' on 'p', waits for it and returns its final status. Deletes the
+// txn.
+TxnStatus RunTxn(TxnProcessor *p, Txn *txn)
+{
+  TxnFuture future;
+  p->NewTxnRequest(txn, &future);
+  Txn *result = future.Wait();
+  TxnStatus status = result->Status();
+  delete result;
+  return status;
+}
+
+// Runs a fixed sequence of Put and Expect txns, one at a time, on a new
+// processor in the given modes.
+void CheckPutExpect(CCMode mode, ExecMode exec)
+{
+  TxnProcessor p(mode, exec, TestThreads());
+  map<Key, Value> m;
+
+  // Every key starts out as 0.
+  m[1] = 0;
+  m[2] = 0;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Expect(m)));
+
+  m[1] = 10;
+  m[2] = 20;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Put(m)));
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Expect(m)));
+
+  m[2] = 21;
+  EXPECT_EQ(ABORTED, RunTxn(&p, new Expect(m)));
+  map<Key, Value> m2;
+  m2[2] = 21;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Put(m2)));
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Expect(m)));
+}
+
+// Runs many concurrent Transfers between 'keys' keys on a new processor in the
+// given modes (and with the given lock granularity), with an Audit every so
+// often. Every Audit must see the sum the keys started out with.
+void CheckConservedSum(CCMode mode, ExecMode exec, int keys = 10,
+                       const LockOptions &locks = LockOptions())
+{
+  const int kKeys = keys;
+  const int kTxns = 2000;
+  const int kActive = 50;
+  const Value kBalance = 1000;
+
+  TxnProcessor p(mode, exec, TestThreads(), locks);
+  map<Key, Value> m;
+  for (int i = 0; i < kKeys; i++)
+    m[i] = kBalance;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Put(m)));
+
+  unsigned int seed = mode + 1;
+  int submitted = 0;
+  int finished = 0;
+  while (finished < kTxns)
+  {
+    while (submitted < kTxns && submitted - finished < kActive)
+    {
+      if (submitted % 10 == 0)
+      {
+        p.NewTxnRequest(new Audit(kKeys));
+      }
+      else
+      {
+        Key from = rand_r(&seed) % kKeys;
+        Key to = (from + 1 + rand_r(&seed) % (kKeys - 1)) % kKeys;
+        p.NewTxnRequest(new Transfer(from, to));
+      }
+      submitted++;
+    }
+
+    Txn *txn = p.GetTxnResult(10);
+    EXPECT_TRUE(txn != NULL);
+    if (txn == NULL)
+      return;
+    finished++;
+    EXPECT_EQ(COMMITTED, txn->Status());
+    Audit *audit = dynamic_cast<Audit *>(txn);
+    if (audit != NULL)
+      EXPECT_EQ(kKeys * kBalance, audit->sum_);
+    delete txn;
+  }
+
+  Audit *audit = new Audit(kKeys);
+  TxnFuture future;
+  p.NewTxnRequest(audit, &future);
+  future.Wait();
+  EXPECT_EQ(COMMITTED, audit->Status());
+  EXPECT_EQ(kKeys * kBalance, audit->sum_);
+  delete audit;
+}
+
+// Sets keys 1 and 2 to 1, then runs two Withdraws from them concurrently on a
+// new processor in the given modes. Returns the number of Withdraws that
+// committed.
+int RunWriteSkew(CCMode mode, ExecMode exec)
+{
+  TxnProcessor p(mode, exec, TestThreads());
+  map<Key, Value> m;
+  m[1] = 1;
+  m[2] = 1;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Put(m)));
+
+  std::atomic<int> arrived(0);
+  Txn *txns[2] = {new Withdraw(1, 2, &arrived), new Withdraw(2, 1, &arrived)};
+  p.NewTxnRequests(txns, 2);
+  int committed = 0;
+  for (int i = 0; i < 2; i++)
+  {
+    Txn *txn = p.GetTxnResult(10);
+    EXPECT_TRUE(txn != NULL);
+    if (txn == NULL)
+      break;
+    if (txn->Status() == COMMITTED)
+      committed++;
+    delete txn;
+  }
+
+  // Each committed Withdraw took one unit (key 0 stays 0).
+  Audit *audit = new Audit(3);
+  TxnFuture future;
+  p.NewTxnRequest(audit, &future);
+  future.Wait();
+  EXPECT_EQ(static_cast<Value>(2 - committed), audit->sum_);
+  delete audit;
+  return committed;
+}
+
+// Starts a GatedPut of 'older' on 'p', lets a Put of 'newer' (which gets the
+// larger id) commit while the GatedPut waits, then lets the GatedPut finish.
+void RunOvertakenPut(TxnProcessor *p, const map<Key, Value> &older,
+                     const map<Key, Value> &newer)
+{
+  std::atomic<bool> started(false);
+  std::atomic<bool> open(false);
+  TxnFuture future;
+  p->NewTxnRequest(new GatedPut(older, &started, &open), &future);
+  double deadline = GetTime() + 10;
+  while (!started && GetTime() < deadline)
+    sched_yield();
+  EXPECT_EQ(COMMITTED, RunTxn(p, new Put(newer)));
+  open = true;
+  Txn *txn = future.Wait();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  delete txn;
+}
+
+// Sets keys 1, 2 and 3 to 1, 0 and 0 on a new processor in the given modes,
+// and if 'extend' is set, copies key 1 to key 2, which leaves key 1 read at a
+// later logical time than it was written. Then starts a GatedCopy of key 1 to
+// key 3, and commits a Put of 5 to key 1 while it waits. Returns the value the
+// GatedCopy copied: 1 if it committed as if it ran before the Put, or 5 if it
+// was restarted.
+Value RunOvertakenCopy(CCMode mode, ExecMode exec, bool extend)
+{
+  TxnProcessor p(mode, exec, TestThreads());
+  map<Key, Value> m;
+  m[1] = 1;
+  m[2] = 0;
+  m[3] = 0;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Put(m)));
+  if (extend)
+  {
+    std::atomic<bool> copied(false);
+    std::atomic<bool> unblocked(true);
+    EXPECT_EQ(COMMITTED, RunTxn(&p, new GatedCopy(1, 2, &copied, &unblocked)));
+  }
+
+  std::atomic<bool> started(false);
+  std::atomic<bool> open(false);
+  TxnFuture future;
+  p.NewTxnRequest(new GatedCopy(1, 3, &started, &open), &future);
+  double deadline = GetTime() + 10;
+  while (!started && GetTime() < deadline)
+    sched_yield();
+
+  map<Key, Value> m1;
+  m1[1] = 5;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Put(m1)));
+  open = true;
+  Txn *txn = future.Wait();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  delete txn;
+
+  // Key 0 stays 0, key 1 is 5, and key 2 is 1 if it was copied to.
+  Audit *audit = new Audit(4);
+  TxnFuture audited;
+  p.NewTxnRequest(audit, &audited);
+  audited.Wait();
+  EXPECT_EQ(COMMITTED, audit->Status());
+  Value copied = audit->sum_ - 5 - (extend ? 1 : 0);
+  delete audit;
+  return copied;
+}
+
+// Sets keys 1, 2 and 3 to 1, 0 and 0, then starts a GatedCopy of key 1 to
+// key 2 on a new SSI processor. While it waits, a Put overwrites key 1 (an
+// rw-antidependency from the copy), and if 'pivot' is set, a copy of key 2 to
+// key 3 commits as well (an rw-antidependency to the copy). Returns the value
+// the GatedCopy copied: 1 if it committed as if it ran before the Put, or 5
+// if it was restarted.
+Value RunSSIPivot(ExecMode exec, bool pivot)
+{
+  TxnProcessor p(SSI, exec, TestThreads());
+  map<Key, Value> m;
+  m[1] = 1;
+  m[2] = 0;
+  m[3] = 0;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Put(m)));
+
+  std::atomic<bool> started(false);
+  std::atomic<bool> open(false);
+  TxnFuture future;
+  p.NewTxnRequest(new GatedCopy(1, 2, &started, &open), &future);
+  double deadline = GetTime() + 10;
+  while (!started && GetTime() < deadline)
+    sched_yield();
+
+  map<Key, Value> m1;
+  m1[1] = 5;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Put(m1)));
+  if (pivot)
+  {
+    std::atomic<bool> copied(false);
+    std::atomic<bool> unblocked(true);
+    EXPECT_EQ(COMMITTED, RunTxn(&p, new GatedCopy(2, 3, &copied, &unblocked)));
+  }
+  open = true;
+  Txn *txn = future.Wait();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  delete txn;
+
+  // Key 0 stays 0, key 1 is 5, and key 3 is still 0.
+  Audit *audit = new Audit(4);
+  TxnFuture audited;
+  p.NewTxnRequest(audit, &audited);
+  audited.Wait();
+  EXPECT_EQ(COMMITTED, audit->Status());
+  Value copied = audit->sum_ - 5;
+  delete audit;
+  return copied;
+}
+
+TEST(TxnFuture_WaitAndReady)
+{
+  TxnProcessor p(LOCKING, SCHEDULED, TestThreads());
+
+  map<Key, Value> m;
+  m[1] = 1;
+  TxnFuture future;
+  EXPECT_FALSE(future.Ready());
+  p.NewTxnRequest(new Put(m), &future);
+  Txn *txn = future.Wait();
+  EXPECT_TRUE(future.Ready());
+  EXPECT_EQ(COMMITTED, txn->Status());
+  delete txn;
+
+  // Free each future as soon as it reports a result, alternately seen through
+  // Ready() and Wait(). The worker must be done with the future by then.
+  for (int i = 0; i < 2000; i++)
+  {
+    TxnFuture *f = new TxnFuture();
+    p.NewTxnRequest(new Noop(), f);
+    if (i % 2 == 0)
+    {
+      while (!f->Ready())
+        sched_yield();
+    }
+    txn = f->Wait();
+    delete f;
+    EXPECT_EQ(COMMITTED, txn->Status());
+    delete txn;
+  }
+
+  // Results handed to a future never show up in GetTxnResult().
+  EXPECT_TRUE(p.GetTxnResult(0.01) == NULL);
+
+  END;
+}
+
+TEST(TxnProcessor_Callbacks)
+{
+  for (CCMode mode = SERIAL; mode <= SSI; mode = static_cast<CCMode>(mode + 1))
+  {
+    TxnProcessor p(mode, SCHEDULED, TestThreads());
+    CountingCallback callback;
+    for (int i = 0; i < 100; i++)
+    {
+      map<Key, Value> m;
+      m[i] = i;
+      p.NewTxnRequest(new Put(m), &callback);
+    }
+    callback.WaitFor(100);
+    EXPECT_EQ(100, *callback.committed_);
+    EXPECT_EQ(0, *callback.aborted_);
+    EXPECT_TRUE(p.GetTxnResult(0.01) == NULL);
+  }
+
+  END;
+}
+
+TEST(TxnProcessor_DirectExec)
+{
+  CCMode modes[] = {P_OCC, MVCC, SILO, TICTOC, SI, SSI};
+  for (uint32 i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    TxnProcessor p(modes[i], DIRECT, TestThreads());
+
+    // A batch of writes, spread over the intake queues.
+    vector<Txn *> batch;
+    map<Key, Value> m;
+    for (int key = 0; key < 100; key++)
+    {
+      m.clear();
+      m[key] = key + 1;
+      batch.push_back(new Put(m));
+    }
+    p.NewTxnRequests(&batch[0], batch.size());
+    for (int j = 0; j < 100; j++)
+    {
+      Txn *txn = p.GetTxnResult(10);
+      EXPECT_TRUE(txn != NULL);
+      if (txn == NULL)
+        break;
+      EXPECT_EQ(COMMITTED, txn->Status());
+      delete txn;
+    }
+
+    // Let the workers park, then check that a new txn wakes one up and sees
+    // every write.
+    usleep(50000);
+    for (int key = 0; key < 100; key++)
+      m[key] = key + 1;
+    TxnFuture future;
+    p.NewTxnRequest(new Expect(m), &future);
+    Txn *txn = future.Wait();
+    EXPECT_EQ(COMMITTED, txn->Status());
+    delete txn;
+  }
+
+  END;
+}
+
+TEST(POCC_Correctness)
+{
+  CheckPutExpect(P_OCC, SCHEDULED);
+  CheckPutExpect(P_OCC, DIRECT);
+  CheckConservedSum(P_OCC, SCHEDULED);
+  CheckConservedSum(P_OCC, DIRECT);
+
+  END;
+}
+
+TEST(Silo_Correctness)
+{
+  CheckPutExpect(SILO, SCHEDULED);
+  CheckPutExpect(SILO, DIRECT);
+  CheckConservedSum(SILO, SCHEDULED);
+  CheckConservedSum(SILO, DIRECT);
+
+  // A read of a record that was overwritten since (so its TID changed) fails
+  // validation, however the reads and writes could have been ordered.
+  EXPECT_EQ(static_cast<Value>(5), RunOvertakenCopy(SILO, SCHEDULED, false));
+  EXPECT_EQ(static_cast<Value>(5), RunOvertakenCopy(SILO, DIRECT, false));
+  EXPECT_EQ(static_cast<Value>(5), RunOvertakenCopy(SILO, SCHEDULED, true));
+  EXPECT_EQ(static_cast<Value>(5), RunOvertakenCopy(SILO, DIRECT, true));
+
+  END;
+}
+
+TEST(TicToc_Correctness)
+{
+  CheckPutExpect(TICTOC, SCHEDULED);
+  CheckPutExpect(TICTOC, DIRECT);
+  CheckConservedSum(TICTOC, SCHEDULED);
+  CheckConservedSum(TICTOC, DIRECT);
+
+  // Once the copy of key 1 to key 2 has extended key 1's rts, a later copy of
+  // key 1 can commit at a logical time before the overwriting Put, so it
+  // keeps the value it read. Plain OCC restarts it.
+  EXPECT_EQ(static_cast<Value>(1), RunOvertakenCopy(TICTOC, SCHEDULED, true));
+  EXPECT_EQ(static_cast<Value>(1), RunOvertakenCopy(TICTOC, DIRECT, true));
+  EXPECT_EQ(static_cast<Value>(5), RunOvertakenCopy(P_OCC, SCHEDULED, true));
+
+  // Without it, the copy has to extend key 1's rts itself, which fails since
+  // key 1 has changed.
+  EXPECT_EQ(static_cast<Value>(5), RunOvertakenCopy(TICTOC, SCHEDULED, false));
+  EXPECT_EQ(static_cast<Value>(5), RunOvertakenCopy(TICTOC, DIRECT, false));
+
+  END;
+}
+
+TEST(Adaptive_Correctness)
+{
+  // With only two keys nearly every pair of txns conflicts, so the processor
+  // switches away from OCC (and possibly back) while txns are in flight.
+  CheckPutExpect(ADAPTIVE, SCHEDULED);
+  CheckConservedSum(ADAPTIVE, SCHEDULED, 2);
+  CheckConservedSum(ADAPTIVE, SCHEDULED);
+
+  END;
+}
+
+TEST(Hierarchical_LockOptions)
+{
+  CheckPutExpect(LOCKING_HIERARCHICAL, SCHEDULED);
+  CheckConservedSum(LOCKING_HIERARCHICAL, SCHEDULED);
+
+  // Every txn escalates, with several partitions among the keys.
+  LockOptions locks;
+  locks.partition_size_ = 3;
+  locks.escalation_threshold_ = 0;
+  CheckConservedSum(LOCKING_HIERARCHICAL, SCHEDULED, 10, locks);
+
+  // No txn escalates.
+  locks.escalation_threshold_ = 100;
+  CheckConservedSum(LOCKING_HIERARCHICAL, SCHEDULED, 10, locks);
+
+  END;
+}
+
+TEST(Calvin_Correctness)
+{
+  CheckPutExpect(CALVIN, SCHEDULED);
+  CheckConservedSum(CALVIN, SCHEDULED);
+
+  // Writes to the same key take effect in submission order, even when the
+  // whole batch lands in one epoch.
+  TxnProcessor p(CALVIN, SCHEDULED, TestThreads());
+  vector<Txn *> batch;
+  map<Key, Value> m;
+  for (int i = 1; i <= 100; i++)
+  {
+    m[7] = i;
+    batch.push_back(new Put(m));
+  }
+  p.NewTxnRequests(&batch[0], batch.size());
+  for (int i = 0; i < 100; i++)
+  {
+    Txn *txn = p.GetTxnResult(10);
+    EXPECT_TRUE(txn != NULL);
+    if (txn == NULL)
+      break;
+    EXPECT_EQ(COMMITTED, txn->Status());
+    delete txn;
+  }
+  m[7] = 100;
+  EXPECT_EQ(COMMITTED, RunTxn(&p, new Expect(m)));
+
+  END;
+}
+
+TEST(MVCC_SnapshotReads)
+{
+  // Expect and Audit txns are read-only, so they take the latch-free
+  // snapshot path; under concurrent Transfers every Audit must still see a
+  // consistent snapshot.
+  CheckPutExpect(MVCC, SCHEDULED);
+  CheckPutExpect(MVCC, DIRECT);
+  CheckConservedSum(MVCC, SCHEDULED);
+  CheckConservedSum(MVCC, DIRECT);
+
+  // Keys outside the storage cannot be read.
+  TxnProcessor p(MVCC, SCHEDULED, TestThreads());
+  map<Key, Value> m;
+  m[2000000] = 0;
+  EXPECT_EQ(ABORTED, RunTxn(&p, new Expect(m)));
+
+  END;
+}
+
+TEST(SnapshotIsolation_Correctness)
+{
+  CCMode modes[] = {SI, SSI};
+  for (int i = 0; i < 2; i++)
+  {
+    CheckPutExpect(modes[i], SCHEDULED);
+    CheckPutExpect(modes[i], DIRECT);
+    CheckConservedSum(modes[i], SCHEDULED);
+    CheckConservedSum(modes[i], DIRECT);
+  }
+
+  // The two Withdraws write different keys, so SI lets both commit (write
+  // skew). SSI must reject one of them.
+  EXPECT_EQ(2, RunWriteSkew(SI, SCHEDULED));
+  EXPECT_EQ(2, RunWriteSkew(SI, DIRECT));
+  EXPECT_EQ(1, RunWriteSkew(SSI, SCHEDULED));
+  EXPECT_EQ(1, RunWriteSkew(SSI, DIRECT));
+
+  // SSI only restarts a txn with rw-antidependencies both to and from
+  // overlapping txns. A single one, which SI's first-committer-wins check
+  // cannot see either, is fine.
+  EXPECT_EQ(static_cast<Value>(1), RunSSIPivot(SCHEDULED, false));
+  EXPECT_EQ(static_cast<Value>(1), RunSSIPivot(DIRECT, false));
+  EXPECT_EQ(static_cast<Value>(5), RunSSIPivot(SCHEDULED, true));
+  EXPECT_EQ(static_cast<Value>(5), RunSSIPivot(DIRECT, true));
+
+  END;
+}
+
+TEST(MVCC_ThomasWriteRule)
+{
+  ExecMode execs[] = {SCHEDULED, DIRECT};
+  for (int i = 0; i < 2; i++)
+  {
+    TxnProcessor p(MVCC, execs[i], TestThreads());
+    map<Key, Value> older, newer;
+
+    // A blind write overtaken on every key by the same txn commits, but its
+    // writes are dropped: the newer values stay.
+    older[5] = 1;
+    older[6] = 1;
+    newer[5] = 2;
+    newer[6] = 2;
+    RunOvertakenPut(&p, older, newer);
+    EXPECT_EQ(COMMITTED, RunTxn(&p, new Expect(newer)));
+
+    // Overtaken on only some keys, it must still be applied to the others.
+    older[5] = 3;
+    older[6] = 3;
+    newer.clear();
+    newer[5] = 4;
+    RunOvertakenPut(&p, older, newer);
+    map<Key, Value> m;
+    m[5] = 4;
+    m[6] = 3;
+    EXPECT_EQ(COMMITTED, RunTxn(&p, new Expect(m)));
+  }
+
+  END;
+}
+
 class LoadGen
 {
 public:
   virtual ~LoadGen() {}
   virtual Txn *NewTxn() = 0;
+
+  // Takes back a finished txn returned by NewTxn(), for reuse.
+  virtual void Recycle(Txn *txn) = 0;
 };
 
 class RMWLoadGen : public LoadGen
@@ -47,10 +833,18 @@ public:
 
   virtual Txn *NewTxn()
   {
-    return new RMW(dbsize_, rsetsize_, wsetsize_, wait_time_);
+    RMW *txn = pool_.Get();
+    txn->Reset(dbsize_, rsetsize_, wsetsize_, wait_time_);
+    return txn;
+  }
+
+  virtual void Recycle(Txn *txn)
+  {
+    pool_.Recycle(static_cast<RMW *>(txn));
   }
 
 private:
+  TxnPool<RMW> pool_;
   int dbsize_;
   int rsetsize_;
   int wsetsize_;
@@ -73,13 +867,21 @@ public:
     // 80% of transactions are READ only transactions and run for the full
     // transaction duration. The rest are very fast (< 0.1ms), high-contention
     // updates.
+    RMW *txn = pool_.Get();
     if (rand() % 100 < 80)
-      return new RMW(dbsize_, rsetsize_, 0, wait_time_);
+      txn->Reset(dbsize_, rsetsize_, 0, wait_time_);
     else
-      return new RMW(dbsize_, 0, wsetsize_, 0);
+      txn->Reset(dbsize_, 0, wsetsize_, 0);
+    return txn;
+  }
+
+  virtual void Recycle(Txn *txn)
+  {
+    pool_.Recycle(static_cast<RMW *>(txn));
   }
 
 private:
+  TxnPool<RMW> pool_;
   int dbsize_;
   int rsetsize_;
   int wsetsize_;
@@ -90,11 +892,10 @@ void Benchmark(const vector<LoadGen *> &lg)
 {
   // Number of transaction requests that can be active at any given time.
   int active_txns = 100;
-  deque<Txn *> doneTxns;
 
   // For each MODE...
   for (CCMode mode = SERIAL;
-       mode <= MVCC;
+       mode <= SSI;
        mode = static_cast<CCMode>(mode + 1))
   {
     // Print out mode name.
@@ -110,29 +911,38 @@ void Benchmark(const vector<LoadGen *> &lg)
         int txn_count = 0;
 
         // Create TxnProcessor in next mode.
-        TxnProcessor *p = new TxnProcessor(mode);
+        TxnProcessor *p = new TxnProcessor(mode, SCHEDULED, thread_options,
+                                           lock_options);
 
         // Record start time.
         double start = GetTime();
 
         // Start specified number of txns running.
+        vector<Txn *> batch;
         for (int i = 0; i < active_txns; i++)
-          p->NewTxnRequest(lg[exp]->NewTxn());
+          batch.push_back(lg[exp]->NewTxn());
+        p->NewTxnRequests(&batch[0], batch.size());
 
         // Keep 100 active txns at all times for the first full second.
+        vector<Txn *> results;
         while (GetTime() < start + 0.5)
         {
-          Txn *txn = p->GetTxnResult();
-          doneTxns.push_back(txn);
-          txn_count++;
-          p->NewTxnRequest(lg[exp]->NewTxn());
+          results.clear();
+          batch.clear();
+          p->GetTxnResults(&results, active_txns);
+          for (uint32 i = 0; i < results.size(); i++)
+          {
+            lg[exp]->Recycle(results[i]);
+            txn_count++;
+            batch.push_back(lg[exp]->NewTxn());
+          }
+          p->NewTxnRequests(&batch[0], batch.size());
         }
 
         // Wait for all of them to finish.
         for (int i = 0; i < active_txns; i++)
         {
-          Txn *txn = p->GetTxnResult();
-          doneTxns.push_back(txn);
+          lg[exp]->Recycle(p->GetTxnResult());
           txn_count++;
         }
 
@@ -141,7 +951,6 @@ void Benchmark(const vector<LoadGen *> &lg)
 
         throughput[round] = txn_count / (end - start);
 
-        doneTxns.clear();
         delete p;
       }
 
@@ -153,22 +962,72 @@ void Benchmark(const vector<LoadGen *> &lg)
   }
 }
 
+// Parses the (optional) command line flags
+//
+//   --benchmark               run the throughput benchmark after the tests
+//   --workers=N               number of worker threads (default: one per CPU)
+//   --scheduler_cpu=C         CPU to pin the scheduler thread to (default:
+//                             unpinned)
+//   --affinity=P              worker placement: none, compact, scatter or numa
+//   --partition_size=N        keys per partition lock (default: 1000)
+//   --escalation_threshold=N  keys a txn locks individually before escalating
+//                             to partition locks (default: 16)
+//
+// into 'thread_options' and 'lock_options'.
+void ParseFlags(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--benchmark") == 0)
+    {
+      run_benchmark = true;
+      continue;
+    }
+
+    const char *value = strchr(argv[i], '=');
+    string flag(argv[i], value == NULL ? strlen(argv[i]) : value - argv[i]);
+    if (value == NULL)
+      DIE("Flag " << argv[i] << " needs a value");
+    value++;
+
+    if (flag == "--workers")
+      thread_options.worker_count_ = atoi(value);
+    else if (flag == "--scheduler_cpu")
+      thread_options.scheduler_cpu_ = atoi(value);
+    else if (flag == "--partition_size")
+      lock_options.partition_size_ = strtoull(value, NULL, 10);
+    else if (flag == "--escalation_threshold")
+      lock_options.escalation_threshold_ = atoi(value);
+    else if (flag != "--affinity" ||
+             !ParseAffinityPolicy(value, &thread_options.affinity_))
+      DIE("Unknown flag " << argv[i]);
+  }
+}
+
 int main(int argc, char **argv)
 {
+  ParseFlags(argc, argv);
+
+  TxnFuture_WaitAndReady();
+  TxnProcessor_Callbacks();
+  TxnProcessor_DirectExec();
+  POCC_Correctness();
+  Silo_Correctness();
+  TicToc_Correctness();
+  Adaptive_Correctness();
+  Hierarchical_LockOptions();
+  Calvin_Correctness();
+  MVCC_SnapshotReads();
+  SnapshotIsolation_Correctness();
+  MVCC_ThomasWriteRule();
+
+  if (!run_benchmark)
+    return 0;
+
   cout << "\t\t\t    Average Transaction Duration" << endl;
   cout << "\t\t0.1ms\t\t1ms\t\t10ms";
   cout << endl;
 
-  cpu_set_t cs;
-  CPU_ZERO(&cs);
-  CPU_SET(7, &cs);
-  int ret = sched_setaffinity(0, sizeof(cs), &cs);
-  if (ret)
-  {
-    perror("sched_setaffinity");
-    assert(false);
-  }
-
   vector<LoadGen *> lg;
 
   cout << "'Low contention' Read only (5 records)" << endl;
@@ -79,17 +79,28 @@ class RMW : public Txn {
  public:
   explicit RMW(double time = 0) : time_(time) {}
   RMW(const set<Key>& writeset, double time = 0) : time_(time) {
-    writeset_ = writeset;
+    writeset_.assign(writeset.begin(), writeset.end());
   }
   RMW(const set<Key>& readset, const set<Key>& writeset, double time = 0)
       : time_(time) {
-    readset_ = readset;
-    writeset_ = writeset;
+    readset_.assign(readset.begin(), readset.end());
+    writeset_.assign(writeset.begin(), writeset.end());
   }
 
   // Constructor with randomized read/write sets
   RMW(int dbsize, int readsetsize, int writesetsize, double time = 0)
       : time_(time) {
+    Reset(dbsize, readsetsize, writesetsize, time);
+  }
+
+  using Txn::Reset;
+
+  // Resets the txn (see Txn::Reset()) and gives it new randomized read/write
+  // sets, without allocating.
+  void Reset(int dbsize, int readsetsize, int writesetsize, double time = 0) {
+    Txn::Reset();
+    time_ = time;
+
     // Make sure we can find enough unique keys.
     DCHECK(dbsize >= readsetsize + writesetsize);
 
@@ -121,11 +132,11 @@ class RMW : public Txn {
   virtual void Run() {
     Value result;
     // Read everything in readset.
-    for (set<Key>::iterator it = readset_.begin(); it != readset_.end(); ++it)
+    for (KeySet::iterator it = readset_.begin(); it != readset_.end(); ++it)
       Read(*it, &result);
 
     // Increment length of everything in writeset.
-    for (set<Key>::iterator it = writeset_.begin(); it != writeset_.end();
+    for (KeySet::iterator it = writeset_.begin(); it != writeset_.end();
          ++it) {
       result = 0;
       Read(*it, &result);
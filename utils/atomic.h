@@ -2,15 +2,27 @@
 #ifndef _DB_UTILS_ATOMIC_H_
 #define _DB_UTILS_ATOMIC_H_
 
+#include <atomic>
+#include <functional>
 #include <queue>
 #include <tr1/unordered_map>
 #include <set>
+#include <type_traits>
+#include <vector>
 
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "utils/mutex.h"
 
 using std::queue;
 using std::set;
+using std::vector;
 using std::tr1::unordered_map;
 
 /// @class AtomicMap<K, V>
@@ -141,170 +153,638 @@ class AtomicSet {
 
 /// @class AtomicQueue<T>
 ///
-/// Queue with atomic push and pop operations.
+/// Multi-producer multi-consumer FIFO queue with atomic push and pop
+/// operations.
 ///
-/// @TODO(alex): This should use lower-contention synchronization.
+/// Elements live in a bounded lock-free ring buffer (Dmitry Vyukov's MPMC
+/// queue): each slot carries a sequence number that tells producers and
+/// consumers whether it is free or full for the current lap, so an operation
+/// only has to claim a position with a single CAS on the shared head or tail
+/// index. Batch operations claim a run of consecutive positions with one CAS.
+///
+/// Push never fails: should the ring fill up, elements spill into a locked
+/// overflow queue, and while it is non-empty all pushes go there (preserving
+/// each producer's order) until consumers have moved its elements back into
+/// the ring.
+///
+/// Threads only take a mutex in order to sleep in (and be woken up from) the
+/// Wait* methods.
 template<typename T>
 class AtomicQueue {
  public:
-  AtomicQueue() {}
+  // The ring holds 'capacity' elements, rounded up to a power of two.
+  explicit AtomicQueue(size_t capacity = 4096)
+      : enqueue_pos_(0), dequeue_pos_(0), overflow_size_(0), waiters_(0) {
+    size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    mask_ = size - 1;
+    ring_ = new Cell[size];
+    for (size_t i = 0; i < size; i++)
+      ring_[i].sequence_.store(i, std::memory_order_relaxed);
+    pthread_cond_init(&nonempty_, NULL);
+  }
+
+  ~AtomicQueue() {
+    delete[] ring_;
+    pthread_cond_destroy(&nonempty_);
+  }
 
   // Returns the number of elements currently in the queue.
   int Size() {
-    mutex_.Lock();
-    int size = queue_.size();
-    mutex_.Unlock();
-    return size;
+    size_t dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+    size_t enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+    int size = (enqueued > dequeued) ? enqueued - dequeued : 0;
+    return size + overflow_size_.load(std::memory_order_relaxed);
   }
 
   // Atomically pushes 'item' onto the queue.
   void Push(const T& item) {
-    mutex_.Lock();
-    queue_.push(item);
-    mutex_.Unlock();
+    if (overflow_size_.load(std::memory_order_acquire) > 0 ||
+        RingPushBatch(&item, 1) == 0) {
+      overflow_mutex_.Lock();
+      overflow_.push(item);
+      overflow_size_++;
+      overflow_mutex_.Unlock();
+    }
+    WakeWaiters(false);
   }
 
   // If the queue is non-empty, (atomically) sets '*result' equal to the front
   // element, pops the front element from the queue, and returns true,
   // otherwise returns false.
   bool Pop(T* result) {
-    mutex_.Lock();
-    if (!queue_.empty()) {
-      *result = queue_.front();
-      queue_.pop();
-      mutex_.Unlock();
+    if (RingPopBatch(result, NULL, 1) == 1)
       return true;
-    } else {
-      mutex_.Unlock();
-      return false;
+    return Refill() && RingPopBatch(result, NULL, 1) == 1;
+  }
+
+  // Atomically pushes the 'n' elements of 'items' onto the queue, in order.
+  void PushBatch(const T* items, size_t n) {
+    size_t pushed = 0;
+    if (overflow_size_.load(std::memory_order_acquire) == 0) {
+      size_t count;
+      while (pushed < n &&
+             (count = RingPushBatch(items + pushed, n - pushed)) > 0)
+        pushed += count;
     }
+    if (pushed < n) {
+      overflow_mutex_.Lock();
+      for (size_t i = pushed; i < n; i++)
+        overflow_.push(items[i]);
+      overflow_size_ += n - pushed;
+      overflow_mutex_.Unlock();
+    }
+    WakeWaiters(true);
   }
 
-  // If mutex is immediately acquired, pushes and returns true, else immediately
-  // returns false.
+  // Pushes 'item' and returns true if there is room for it in the ring, else
+  // immediately returns false.
   bool PushNonBlocking(const T& item) {
-    if (mutex_.TryLock()) {
-      queue_.push(item);
-      mutex_.Unlock();
+    if (overflow_size_.load(std::memory_order_acquire) > 0 ||
+        RingPushBatch(&item, 1) == 0)
+      return false;
+    WakeWaiters(false);
+    return true;
+  }
+
+  // Same as 'Pop(result)', which never blocks.
+  bool PopNonBlocking(T* result) {
+    return Pop(result);
+  }
+
+  // Like 'Pop(result)', but if the queue is empty, sleeps until an element is
+  // pushed. If 'timeout' is non-negative, gives up and returns false once
+  // 'timeout' seconds have passed without an element becoming available.
+  bool WaitPop(T* result, double timeout = -1) {
+    if (Pop(result))
       return true;
-    } else {
+    if (timeout == 0)
       return false;
+
+    struct timespec deadline;
+    Deadline(timeout, &deadline);
+    mutex_.Lock();
+    waiters_++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool found;
+    while (!(found = Pop(result)) && Sleep(timeout, &deadline)) {}
+    waiters_--;
+    mutex_.Unlock();
+    return found;
+  }
+
+  // Atomically pops up to 'max' elements from the front of the queue, appending
+  // them to '*results'. Returns the number of elements popped.
+  size_t PopBatch(vector<T>* results, size_t max) {
+    size_t count = 0;
+    size_t popped;
+    while (count < max &&
+           ((popped = RingPopBatch(NULL, results, max - count)) > 0 ||
+            (Refill() && (popped = RingPopBatch(NULL, results, max - count)) > 0)))
+      count += popped;
+    return count;
+  }
+
+  // Like 'PopBatch(results, max)', but first waits for the queue to become
+  // non-empty, as in 'WaitPop'. Returns 0 only if the wait timed out.
+  size_t WaitPopBatch(vector<T>* results, size_t max, double timeout = -1) {
+    size_t count = PopBatch(results, max);
+    if (count > 0 || timeout == 0)
+      return count;
+
+    struct timespec deadline;
+    Deadline(timeout, &deadline);
+    mutex_.Lock();
+    waiters_++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while ((count = PopBatch(results, max)) == 0 && Sleep(timeout, &deadline)) {}
+    waiters_--;
+    mutex_.Unlock();
+    return count;
+  }
+
+ private:
+  // A ring slot. It is free for the producer that claims position 'pos' iff
+  // sequence_ == pos, and full for the consumer that claims position 'pos'
+  // iff sequence_ == pos + 1.
+  struct Cell {
+    std::atomic<size_t> sequence_;
+    T data_;
+  };
+
+  // Claims up to 'n' consecutive free ring positions, fills them with the
+  // first elements of 'items' and returns how many it filled (0 if the ring
+  // is full).
+  size_t RingPushBatch(const T* items, size_t n) {
+    if (n == 0)
+      return 0;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    size_t count;
+    while (true) {
+      count = 0;
+      while (count < n && count <= mask_ &&
+             ring_[(pos + count) & mask_].sequence_.load(
+                 std::memory_order_acquire) == pos + count)
+        count++;
+      if (count == 0) {
+        // Either the ring is full, or another producer got here first.
+        size_t seq = ring_[pos & mask_].sequence_.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(seq - pos) < 0)
+          return 0;
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      } else if (enqueue_pos_.compare_exchange_weak(pos, pos + count,
+                                                    std::memory_order_relaxed)) {
+        break;
+      }
     }
+
+    for (size_t i = 0; i < count; i++) {
+      Cell* cell = &ring_[(pos + i) & mask_];
+      cell->data_ = items[i];
+      cell->sequence_.store(pos + i + 1, std::memory_order_release);
+    }
+    return count;
   }
 
-  // If mutex is immediately acquired AND queue is nonempty, pops and returns
-  // true, else returns false.
-  bool PopNonBlocking(T* result) {
-    if (mutex_.TryLock()) {
-      if (!queue_.empty()) {
-        *result = queue_.front();
-        queue_.pop();
-        mutex_.Unlock();
-        return true;
-      } else {
-        mutex_.Unlock();
-        return false;
+  // Claims up to 'max' consecutive full ring positions and takes their
+  // elements, storing them at 'result' (if non-NULL) or appending them to
+  // '*results'. Returns how many it took (0 if the ring is empty).
+  size_t RingPopBatch(T* result, vector<T>* results, size_t max) {
+    if (max == 0)
+      return 0;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    size_t count;
+    while (true) {
+      count = 0;
+      while (count < max && count <= mask_ &&
+             ring_[(pos + count) & mask_].sequence_.load(
+                 std::memory_order_acquire) == pos + count + 1)
+        count++;
+      if (count == 0) {
+        // Either the ring is empty, or another consumer got here first.
+        size_t seq = ring_[pos & mask_].sequence_.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(seq - (pos + 1)) < 0)
+          return 0;
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      } else if (dequeue_pos_.compare_exchange_weak(pos, pos + count,
+                                                    std::memory_order_relaxed)) {
+        break;
       }
-    } else {
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      Cell* cell = &ring_[(pos + i) & mask_];
+      if (results == NULL)
+        result[i] = cell->data_;
+      else
+        results->push_back(cell->data_);
+      cell->sequence_.store(pos + i + mask_ + 1, std::memory_order_release);
+    }
+    return count;
+  }
+
+  // Moves as many overflowed elements as fit back into the ring. Returns true
+  // if it moved any.
+  bool Refill() {
+    if (overflow_size_.load(std::memory_order_acquire) == 0)
       return false;
+    overflow_mutex_.Lock();
+    size_t moved = 0;
+    while (!overflow_.empty() && RingPushBatch(&overflow_.front(), 1) == 1) {
+      overflow_.pop();
+      moved++;
     }
+    overflow_size_ -= moved;
+    overflow_mutex_.Unlock();
+    return moved > 0;
   }
 
- private:
-  queue<T> queue_;
+  // Wakes up one (or, if 'all', every) thread sleeping in a Wait* method.
+  void WakeWaiters(bool all) {
+    // Pairs with the fence in the Wait* methods: either the waiter sees the
+    // pushed element, or we see the waiter.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) > 0) {
+      mutex_.Lock();
+      if (all)
+        pthread_cond_broadcast(&nonempty_);
+      else
+        pthread_cond_signal(&nonempty_);
+      mutex_.Unlock();
+    }
+  }
+
+  // Sets '*deadline' to 'timeout' seconds from now, if 'timeout' is positive.
+  static void Deadline(double timeout, struct timespec* deadline) {
+    if (timeout > 0) {
+      clock_gettime(CLOCK_REALTIME, deadline);
+      time_t secs = static_cast<time_t>(timeout);
+      deadline->tv_sec += secs;
+      deadline->tv_nsec += static_cast<long>((timeout - secs) * 1e9);
+      if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+      }
+    }
+  }
+
+  // Sleeps until woken up by a push, or until 'deadline' if 'timeout' is
+  // non-negative. Returns false if the deadline has passed.
+  //
+  // Requires: mutex_ is held.
+  bool Sleep(double timeout, struct timespec* deadline) {
+    if (timeout < 0) {
+      pthread_cond_wait(&nonempty_, &mutex_.mutex_);
+      return true;
+    }
+    return pthread_cond_timedwait(&nonempty_, &mutex_.mutex_, deadline) !=
+           ETIMEDOUT;
+  }
+
+  // The ring, and the number of slots minus one.
+  Cell* ring_;
+  size_t mask_;
+
+  // Next positions to push to and to pop from. Each sits on its own cache
+  // line, so that producers and consumers do not invalidate each other's
+  // cached copy.
+  char pad0_[64];
+  std::atomic<size_t> enqueue_pos_;
+  char pad1_[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> dequeue_pos_;
+  char pad2_[64 - sizeof(std::atomic<size_t>)];
+
+  // Elements pushed while the ring was full.
+  queue<T> overflow_;
+  Mutex overflow_mutex_;
+  std::atomic<size_t> overflow_size_;
+
+  // Signalled when an element is pushed while threads are waiting for one.
   Mutex mutex_;
+  pthread_cond_t nonempty_;
+  std::atomic<int> waiters_;
 };
 
-// An atomically modifiable object. T is required to be a simple numeric type
-// or simple struct.
+/// @class WorkStealingDeque<T>
+///
+/// Chase-Lev work-stealing deque, using the memory orders of Le et al.,
+/// "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+///
+/// A single owner thread pushes and pops elements at the bottom (LIFO), while
+/// any number of other threads steal elements from the top (FIFO). Owner
+/// operations touch no shared cache line unless the deque is almost empty;
+/// a steal is a single CAS on the top index. The buffer grows as needed.
+/// Replaced buffers are kept until the deque is destroyed, because thieves
+/// may still be reading them.
+///
+/// Requires: T is a trivially copyable type, e.g. a pointer.
+template<typename T>
+class WorkStealingDeque {
+ public:
+  // The buffer initially holds 'capacity' elements, rounded up to a power of
+  // two.
+  explicit WorkStealingDeque(size_t capacity = 256) : top_(0), bottom_(0) {
+    size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    buffers_.push_back(new Buffer(size));
+    buffer_.store(buffers_.back(), std::memory_order_relaxed);
+  }
+
+  ~WorkStealingDeque() {
+    for (size_t i = 0; i < buffers_.size(); i++)
+      delete buffers_[i];
+  }
+
+  // Returns the (approximate) number of elements in the deque.
+  int Size() {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    return (bottom > top) ? bottom - top : 0;
+  }
+
+  // Pushes 'item' onto the bottom of the deque.
+  //
+  // Requires: only called by the owner thread.
+  void Push(const T& item) {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    if (bottom - top > static_cast<int64_t>(buffer->mask_))
+      buffer = Grow(buffer, top, bottom);
+    buffer->Put(bottom, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  // If the deque is non-empty, pops the bottom (most recently pushed)
+  // element into '*result' and returns true, otherwise returns false.
+  //
+  // Requires: only called by the owner thread.
+  bool Pop(T* result) {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+      // Empty.
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+    *result = buffer->Get(bottom);
+    if (top == bottom) {
+      // Last element: race thieves for it.
+      bool won = top_.compare_exchange_strong(top, top + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // Tries to steal the top (least recently pushed) element into '*result'.
+  // Returns false if the deque is empty or another thread took the element
+  // first.
+  bool Steal(T* result) {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom)
+      return false;
+    // Acquire (rather than consume) pairs with the release store in Grow().
+    Buffer* buffer = buffer_.load(std::memory_order_acquire);
+    T item = buffer->Get(top);
+    if (!top_.compare_exchange_strong(top, top + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return false;
+    *result = item;
+    return true;
+  }
+
+ private:
+  // Not copyable.
+  WorkStealingDeque(const WorkStealingDeque&);
+  WorkStealingDeque& operator=(const WorkStealingDeque&);
+
+  // A circular array of elements, indexed by position modulo its size.
+  struct Buffer {
+    explicit Buffer(size_t size) : mask_(size - 1) {
+      items_ = new std::atomic<T>[size];
+    }
+    ~Buffer() { delete[] items_; }
+
+    T Get(int64_t i) {
+      return items_[i & mask_].load(std::memory_order_relaxed);
+    }
+    void Put(int64_t i, const T& item) {
+      items_[i & mask_].store(item, std::memory_order_relaxed);
+    }
+
+    size_t mask_;
+    std::atomic<T>* items_;
+  };
+
+  // Replaces 'buffer' by one twice its size holding the elements at positions
+  // [top, bottom), and returns it.
+  Buffer* Grow(Buffer* buffer, int64_t top, int64_t bottom) {
+    Buffer* grown = new Buffer(2 * (buffer->mask_ + 1));
+    for (int64_t i = top; i < bottom; i++)
+      grown->Put(i, buffer->Get(i));
+    buffers_.push_back(grown);
+    buffer_.store(grown, std::memory_order_release);
+    return grown;
+  }
+
+  // Position of the top element, written by thieves and (for the last
+  // element) the owner. Kept off the owner's cache line.
+  std::atomic<int64_t> top_;
+  char pad0_[64 - sizeof(std::atomic<int64_t>)];
+
+  // Position one past the bottom element. Only written by the owner.
+  std::atomic<int64_t> bottom_;
+  std::atomic<Buffer*> buffer_;
+  char pad1_[64 - sizeof(std::atomic<int64_t>) - sizeof(std::atomic<Buffer*>)];
+
+  // Every buffer the deque has used. Owner-only.
+  vector<Buffer*> buffers_;
+};
+
+// An atomically modifiable object, built on std::atomic. T is required to be a
+// simple numeric type or simple struct (the arithmetic operators are only
+// available for numeric types). Reads have acquire semantics, assignments
+// release semantics and read-modify-write operations both, unless Load and
+// Store are passed another memory order.
 template<typename T>
 class Atomic {
  public:
-  Atomic() {}
+  Atomic() : value_(T()) {}
   Atomic(T init) : value_(init) {}
 
   // Returns the current value.
-  T operator* () {
-    return value_;
+  T operator* () const {
+    return value_.load(std::memory_order_acquire);
+  }
+
+  // Returns the current value, read with memory order 'order'.
+  T Load(std::memory_order order = std::memory_order_acquire) const {
+    return value_.load(order);
+  }
+
+  // Sets the value to 'x', written with memory order 'order'.
+  void Store(T x, std::memory_order order = std::memory_order_release) {
+    value_.store(x, order);
   }
 
   // Atomically increments the value.
   void operator++ () {
-    mutex_.Lock();
-    value_++;
-    mutex_.Unlock();
+    Add(1, typename std::is_integral<T>::type());
   }
 
   // Atomically increments the value by 'x'.
   void operator+= (T x) {
-    mutex_.Lock();
-    value_+=x;
-    mutex_.Unlock();
+    Add(x, typename std::is_integral<T>::type());
   }
 
   // Atomically decrements the value.
   void operator-- () {
-    mutex_.Lock();
-    value_--;
-    mutex_.Unlock();
+    Sub(1, typename std::is_integral<T>::type());
   }
 
   // Atomically decrements the value by 'x'.
   void operator-= (T x) {
-    mutex_.Lock();
-    value_ -= x;
-    mutex_.Unlock();
+    Sub(x, typename std::is_integral<T>::type());
   }
 
   // Atomically multiplies the value by 'x'.
   void operator*= (T x) {
-    mutex_.Lock();
-    value_ *= x;
-    mutex_.Unlock();
+    Apply(x, std::multiplies<T>());
   }
 
   // Atomically divides the value by 'x'.
   void operator/= (T x) {
-    mutex_.Lock();
-    value_ /= x;
-    mutex_.Unlock();
+    Apply(x, std::divides<T>());
   }
 
   // Atomically %'s the value by 'x'.
   void operator%= (T x) {
-    mutex_.Lock();
-    value_ %= x;
-    mutex_.Unlock();
+    Apply(x, std::modulus<T>());
   }
 
   // Atomically assigns the value to equal 'x'.
   void operator= (T x) {
-    mutex_.Lock();
-    value_ = x;
-    mutex_.Unlock();
+    value_.store(x, std::memory_order_release);
   }
 
   // Checks if the value is equal to 'old_value'. If so, atomically sets the
   // value to 'new_value' and returns true, otherwise sets '*old_value' equal
   // to the value at the time of the comparison and returns false.
-  //
-  // TODO(alex): Use C++ <atomic> library to improve performance?
   bool CAS(T* old_value, T new_value) {
-    mutex_.Lock();
-    if (value_ == *old_value) {
-      value_ = new_value;
-      mutex_.Unlock();
-      return true;
-    } else {
-      *old_value = value_;
-      mutex_.Unlock();
-      return false;
-    }
+    return value_.compare_exchange_strong(*old_value, new_value,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire);
   }
 
  private:
-  T value_;
-  Mutex mutex_;
+  // Not copyable.
+  Atomic(const Atomic&);
+  Atomic& operator=(const Atomic&);
+
+  // Adds 'x' to the value: with a single fetch_add for integral types, and a
+  // CAS loop otherwise.
+  void Add(T x, std::true_type) {
+    value_.fetch_add(x, std::memory_order_acq_rel);
+  }
+  void Add(T x, std::false_type) {
+    Apply(x, std::plus<T>());
+  }
+
+  // Subtracts 'x' from the value, likewise.
+  void Sub(T x, std::true_type) {
+    value_.fetch_sub(x, std::memory_order_acq_rel);
+  }
+  void Sub(T x, std::false_type) {
+    Apply(x, std::minus<T>());
+  }
+
+  // Atomically replaces the value 'v' by 'op(v, x)'.
+  template<typename Op>
+  void Apply(T x, Op op) {
+    T old_value = value_.load(std::memory_order_relaxed);
+    while (!value_.compare_exchange_weak(old_value, op(old_value, x),
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_relaxed)) {}
+  }
+
+  std::atomic<T> value_;
+};
+
+/// @class ShardedCounter
+///
+/// Counter for statistics that many threads update at a high rate. Each CPU
+/// adds to its own shard on its own cache line, so that updates from
+/// different cores never contend; reading the counter sums up all shards.
+/// Updates are relaxed: the counter orders no other memory accesses.
+class ShardedCounter {
+ public:
+  ShardedCounter() {
+    size_t count = 1;
+    while (count < static_cast<size_t>(sysconf(_SC_NPROCESSORS_CONF)))
+      count *= 2;
+    mask_ = count - 1;
+    void* shards;
+    if (posix_memalign(&shards, sizeof(Shard), count * sizeof(Shard)) != 0)
+      abort();
+    shards_ = reinterpret_cast<Shard*>(shards);
+    for (size_t i = 0; i < count; i++)
+      shards_[i].value_.store(0, std::memory_order_relaxed);
+  }
+
+  ~ShardedCounter() {
+    free(shards_);
+  }
+
+  // Adds 'n' to the counter.
+  void Add(int64_t n = 1) {
+    int cpu = sched_getcpu();
+    Shard* shard = &shards_[(cpu < 0 ? 0 : cpu) & mask_];
+    shard->value_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  // Returns the current count.
+  int64_t Read() const {
+    int64_t sum = 0;
+    for (size_t i = 0; i <= mask_; i++)
+      sum += shards_[i].value_.load(std::memory_order_relaxed);
+    return sum;
+  }
+
+  // Returns the current count and resets the counter to zero. An Add() that
+  // races with Take() is counted either now or by the next Take().
+  int64_t Take() {
+    int64_t sum = 0;
+    for (size_t i = 0; i <= mask_; i++)
+      sum += shards_[i].value_.exchange(0, std::memory_order_relaxed);
+    return sum;
+  }
+
+ private:
+  // Not copyable.
+  ShardedCounter(const ShardedCounter&);
+  ShardedCounter& operator=(const ShardedCounter&);
+
+  struct Shard {
+    std::atomic<int64_t> value_;
+    char pad_[64 - sizeof(std::atomic<int64_t>)];
+  };
+
+  // One shard per CPU (rounded up to a power of two), cache-line aligned.
+  Shard* shards_;
+  size_t mask_;
 };
 
 #endif  // _DB_UTILS_ATOMIC_H_
@@ -0,0 +1,468 @@
+
+#include "utils/atomic.h"
+
+#include <time.h>
+#include <vector>
+
+#include "utils/testing.h"
+
+using std::vector;
+
+// Returns the current time in seconds.
+static double Now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Starts 'n' threads running 'function', passing thread i 'args[i]'.
+template<typename Arg>
+static void StartThreads(int n, void* (*function)(void*), Arg* args,
+                         vector<pthread_t>* threads) {
+  threads->resize(n);
+  for (int i = 0; i < n; i++)
+    pthread_create(&(*threads)[i], NULL, function, &args[i]);
+}
+
+static void JoinThreads(vector<pthread_t>* threads) {
+  for (size_t i = 0; i < threads->size(); i++)
+    pthread_join((*threads)[i], NULL);
+}
+
+TEST(AtomicQueue_OverflowKeepsOrder) {
+  // A ring of 4 slots, so that almost everything spills.
+  AtomicQueue<int> q(4);
+  for (int i = 0; i < 100; i++)
+    q.Push(i);
+  EXPECT_EQ(100, q.Size());
+
+  // While elements are spilled, nothing may jump ahead of them.
+  EXPECT_FALSE(q.PushNonBlocking(100));
+  int batch[10];
+  for (int i = 0; i < 10; i++)
+    batch[i] = 100 + i;
+  q.PushBatch(batch, 10);
+  EXPECT_EQ(110, q.Size());
+
+  int x;
+  for (int i = 0; i < 50; i++) {
+    EXPECT_TRUE(q.Pop(&x));
+    EXPECT_EQ(i, x);
+  }
+  vector<int> results;
+  EXPECT_EQ(60, q.PopBatch(&results, 1000));
+  for (int i = 0; i < 60; i++)
+    EXPECT_EQ(50 + i, results[i]);
+  EXPECT_EQ(0, q.Size());
+  EXPECT_FALSE(q.Pop(&x));
+
+  // Once drained, pushes go back to the ring.
+  EXPECT_TRUE(q.PushNonBlocking(7));
+  EXPECT_TRUE(q.Pop(&x));
+  EXPECT_EQ(7, x);
+
+  END;
+}
+
+// Pushes 'x_' onto 'queue_' after 'delay_' seconds.
+struct DelayedPush {
+  AtomicQueue<int>* queue_;
+  double delay_;
+  int x_;
+};
+
+static void* RunDelayedPush(void* arg) {
+  DelayedPush* push = reinterpret_cast<DelayedPush*>(arg);
+  usleep(static_cast<useconds_t>(push->delay_ * 1e6));
+  push->queue_->Push(push->x_);
+  return NULL;
+}
+
+TEST(AtomicQueue_WaitPop) {
+  AtomicQueue<int> q;
+  int x;
+
+  // Times out on an empty queue, and returns at once with a zero timeout.
+  double start = Now();
+  EXPECT_FALSE(q.WaitPop(&x, 0.05));
+  EXPECT_TRUE(Now() - start >= 0.04);
+  EXPECT_FALSE(q.WaitPop(&x, 0));
+  vector<int> results;
+  EXPECT_EQ(0, q.WaitPopBatch(&results, 10, 0.01));
+
+  // Wakes up for an element pushed while it sleeps.
+  DelayedPush push = {&q, 0.05, 42};
+  vector<pthread_t> threads;
+  StartThreads(1, RunDelayedPush, &push, &threads);
+  EXPECT_TRUE(q.WaitPop(&x));
+  EXPECT_EQ(42, x);
+  JoinThreads(&threads);
+
+  push.x_ = 43;
+  StartThreads(1, RunDelayedPush, &push, &threads);
+  EXPECT_EQ(1, q.WaitPopBatch(&results, 10, 10));
+  EXPECT_EQ(43, results[0]);
+  JoinThreads(&threads);
+
+  END;
+}
+
+// Producer 'id_' pushes kItems elements id_ * kItems + i in order; a consumer
+// pops until '*popped_' reaches the total, recording what it popped.
+static const int kProducers = 4;
+static const int kConsumers = 4;
+static const int kItems = 20000;
+
+struct QueueWorker {
+  AtomicQueue<int>* queue_;
+  std::atomic<int>* popped_;
+  int id_;
+  vector<int> seen_;
+};
+
+static void* RunProducer(void* arg) {
+  QueueWorker* w = reinterpret_cast<QueueWorker*>(arg);
+  for (int i = 0; i < kItems; i++) {
+    int x = w->id_ * kItems + i;
+    // Mix single and batched pushes.
+    if (i % 3 == 0 && i + 1 < kItems) {
+      int batch[2] = {x, x + 1};
+      w->queue_->PushBatch(batch, 2);
+      i++;
+    } else {
+      w->queue_->Push(x);
+    }
+  }
+  return NULL;
+}
+
+static void* RunConsumer(void* arg) {
+  QueueWorker* w = reinterpret_cast<QueueWorker*>(arg);
+  int x;
+  while (w->popped_->load() < kProducers * kItems) {
+    if (w->queue_->WaitPop(&x, 0.001)) {
+      w->seen_.push_back(x);
+      (*w->popped_)++;
+    }
+  }
+  return NULL;
+}
+
+TEST(AtomicQueue_ConcurrentProducersAndConsumers) {
+  // A small ring, so that the producers keep spilling into the overflow
+  // queue while the consumers refill the ring from it.
+  AtomicQueue<int> q(16);
+  std::atomic<int> popped(0);
+  QueueWorker producers[kProducers];
+  QueueWorker consumers[kConsumers];
+  for (int i = 0; i < kProducers; i++) {
+    producers[i].queue_ = &q;
+    producers[i].id_ = i;
+  }
+  for (int i = 0; i < kConsumers; i++) {
+    consumers[i].queue_ = &q;
+    consumers[i].popped_ = &popped;
+  }
+
+  vector<pthread_t> producer_threads, consumer_threads;
+  StartThreads(kConsumers, RunConsumer, consumers, &consumer_threads);
+  StartThreads(kProducers, RunProducer, producers, &producer_threads);
+  JoinThreads(&producer_threads);
+  JoinThreads(&consumer_threads);
+
+  // Every element was popped exactly once, and each consumer saw each
+  // producer's elements in the order they were pushed.
+  vector<int> count(kProducers * kItems, 0);
+  bool ordered = true;
+  for (int i = 0; i < kConsumers; i++) {
+    vector<int> last(kProducers, -1);
+    for (size_t j = 0; j < consumers[i].seen_.size(); j++) {
+      int x = consumers[i].seen_[j];
+      count[x]++;
+      if (x <= last[x / kItems])
+        ordered = false;
+      last[x / kItems] = x;
+    }
+  }
+  bool once = true;
+  for (size_t i = 0; i < count.size(); i++) {
+    if (count[i] != 1)
+      once = false;
+  }
+  EXPECT_TRUE(once);
+  EXPECT_TRUE(ordered);
+  EXPECT_EQ(0, q.Size());
+
+  END;
+}
+
+TEST(WorkStealingDeque_PopAndSteal) {
+  WorkStealingDeque<int> d(4);
+  int x;
+  EXPECT_FALSE(d.Pop(&x));
+  EXPECT_FALSE(d.Steal(&x));
+
+  // The owner pops the newest element, thieves steal the oldest.
+  d.Push(1);
+  d.Push(2);
+  d.Push(3);
+  EXPECT_EQ(3, d.Size());
+  EXPECT_TRUE(d.Pop(&x));
+  EXPECT_EQ(3, x);
+  EXPECT_TRUE(d.Steal(&x));
+  EXPECT_EQ(1, x);
+  EXPECT_TRUE(d.Pop(&x));
+  EXPECT_EQ(2, x);
+  EXPECT_FALSE(d.Pop(&x));
+  EXPECT_FALSE(d.Steal(&x));
+  EXPECT_EQ(0, d.Size());
+
+  END;
+}
+
+TEST(WorkStealingDeque_WrapAndGrow) {
+  WorkStealingDeque<int> d(4);
+  int x;
+
+  // Walk the positions around the 4-slot buffer many times.
+  bool ok = true;
+  for (int i = 0; i < 1000; i++) {
+    d.Push(3 * i);
+    d.Push(3 * i + 1);
+    d.Push(3 * i + 2);
+    ok = ok && d.Steal(&x) && x == 3 * i;
+    ok = ok && d.Pop(&x) && x == 3 * i + 2;
+    ok = ok && d.Pop(&x) && x == 3 * i + 1;
+  }
+  EXPECT_TRUE(ok);
+
+  // Then grow it while its elements straddle the end of the buffer.
+  d.Push(0);
+  d.Push(1);
+  EXPECT_TRUE(d.Steal(&x));
+  for (int i = 2; i < 100; i++)
+    d.Push(i);
+  EXPECT_EQ(99, d.Size());
+  for (int i = 1; i < 50; i++) {
+    ok = ok && d.Steal(&x) && x == i;
+  }
+  for (int i = 99; i >= 50; i--) {
+    ok = ok && d.Pop(&x) && x == i;
+  }
+  EXPECT_TRUE(ok);
+  EXPECT_FALSE(d.Pop(&x));
+
+  END;
+}
+
+// A thief steals from 'deque_' until '*done_' is set and the deque is empty,
+// counting what it took in 'taken_'.
+struct Thief {
+  WorkStealingDeque<int>* deque_;
+  std::atomic<bool>* done_;
+  vector<int>* taken_;
+};
+
+static void* RunThief(void* arg) {
+  Thief* thief = reinterpret_cast<Thief*>(arg);
+  int x;
+  while (true) {
+    if (thief->deque_->Steal(&x)) {
+      (*thief->taken_)[x]++;
+    } else if (thief->done_->load()) {
+      if (thief->deque_->Size() == 0)
+        break;
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+TEST(WorkStealingDeque_ConcurrentSteals) {
+  const int kThieves = 3;
+  const int kElements = 100000;
+
+  // A small buffer, so that it grows while thieves are stealing.
+  WorkStealingDeque<int> d(4);
+  std::atomic<bool> done(false);
+  vector<vector<int> > taken(kThieves + 1, vector<int>(kElements, 0));
+  Thief thieves[kThieves];
+  for (int i = 0; i < kThieves; i++) {
+    thieves[i].deque_ = &d;
+    thieves[i].done_ = &done;
+    thieves[i].taken_ = &taken[i];
+  }
+  vector<pthread_t> threads;
+  StartThreads(kThieves, RunThief, thieves, &threads);
+
+  // The owner pushes everything, popping some of it back as it goes, so that
+  // it often races the thieves for the last element.
+  int x;
+  for (int i = 0; i < kElements; i++) {
+    d.Push(i);
+    if (i % 3 == 0 && d.Pop(&x))
+      taken[kThieves][x]++;
+  }
+  while (d.Pop(&x))
+    taken[kThieves][x]++;
+  done = true;
+  JoinThreads(&threads);
+
+  // Every element was taken exactly once.
+  bool once = true;
+  for (int i = 0; i < kElements; i++) {
+    int count = 0;
+    for (int j = 0; j <= kThieves; j++)
+      count += taken[j][i];
+    if (count != 1)
+      once = false;
+  }
+  EXPECT_TRUE(once);
+
+  END;
+}
+
+TEST(Atomic_Arithmetic) {
+  Atomic<int> x(10);
+  ++x;
+  x += 5;
+  --x;
+  x -= 3;
+  EXPECT_EQ(12, *x);
+  x *= 4;
+  x /= 3;
+  x %= 7;
+  EXPECT_EQ(2, *x);
+  x = -5;
+  EXPECT_EQ(-5, x.Load());
+
+  int old_value = 0;
+  EXPECT_FALSE(x.CAS(&old_value, 1));
+  EXPECT_EQ(-5, old_value);
+  EXPECT_TRUE(x.CAS(&old_value, 1));
+  EXPECT_EQ(1, *x);
+
+  // Unsigned values wrap around.
+  Atomic<unsigned int> u(1);
+  u -= 2;
+  EXPECT_EQ(~0u, *u);
+  ++u;
+  EXPECT_EQ(0u, *u);
+
+  // Non-integral types take the CAS loop.
+  Atomic<double> d(1.5);
+  d += 1;
+  d -= 0.25;
+  d *= 2;
+  EXPECT_EQ(4.5, *d);
+
+  END;
+}
+
+// Applies 'kUpdates' rounds of updates adding up to +1 to '*counter_' and
+// '*sharded_'.
+static const int kUpdates = 20000;
+
+struct Updater {
+  Atomic<int64_t>* counter_;
+  ShardedCounter* sharded_;
+};
+
+static void* RunUpdater(void* arg) {
+  Updater* updater = reinterpret_cast<Updater*>(arg);
+  for (int i = 0; i < kUpdates; i++) {
+    ++(*updater->counter_);
+    *updater->counter_ += 3;
+    --(*updater->counter_);
+    *updater->counter_ -= 2;
+    updater->sharded_->Add();
+    updater->sharded_->Add(3);
+    updater->sharded_->Add(-3);
+  }
+  return NULL;
+}
+
+TEST(Atomic_ConcurrentUpdates) {
+  const int kThreads = 4;
+  Atomic<int64_t> counter(0);
+  ShardedCounter sharded;
+  Updater updaters[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    updaters[i].counter_ = &counter;
+    updaters[i].sharded_ = &sharded;
+  }
+  vector<pthread_t> threads;
+  StartThreads(kThreads, RunUpdater, updaters, &threads);
+  JoinThreads(&threads);
+  EXPECT_EQ(kThreads * kUpdates, *counter);
+  EXPECT_EQ(kThreads * kUpdates, sharded.Read());
+
+  END;
+}
+
+// Adds 1 to 'counter_' until '*stop_' is set, counting its Add() calls in
+// 'adds_'.
+struct Adder {
+  ShardedCounter* counter_;
+  std::atomic<bool>* stop_;
+  int64_t adds_;
+};
+
+static void* RunAdder(void* arg) {
+  Adder* adder = reinterpret_cast<Adder*>(arg);
+  adder->adds_ = 0;
+  while (!adder->stop_->load()) {
+    adder->counter_->Add();
+    adder->adds_++;
+  }
+  return NULL;
+}
+
+TEST(ShardedCounter_Take) {
+  ShardedCounter counter;
+  EXPECT_EQ(0, counter.Read());
+  counter.Add(5);
+  counter.Add();
+  EXPECT_EQ(6, counter.Read());
+  EXPECT_EQ(6, counter.Take());
+  EXPECT_EQ(0, counter.Read());
+  EXPECT_EQ(0, counter.Take());
+
+  // Adds that race with Take() are counted exactly once over all Takes.
+  const int kThreads = 4;
+  std::atomic<bool> stop(false);
+  Adder adders[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    adders[i].counter_ = &counter;
+    adders[i].stop_ = &stop;
+  }
+  vector<pthread_t> threads;
+  StartThreads(kThreads, RunAdder, adders, &threads);
+  int64_t taken = 0;
+  for (int i = 0; i < 100; i++) {
+    taken += counter.Take();
+    usleep(100);
+  }
+  stop = true;
+  JoinThreads(&threads);
+  taken += counter.Take();
+  int64_t adds = 0;
+  for (int i = 0; i < kThreads; i++)
+    adds += adders[i].adds_;
+  EXPECT_EQ(adds, taken);
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  AtomicQueue_OverflowKeepsOrder();
+  AtomicQueue_WaitPop();
+  AtomicQueue_ConcurrentProducersAndConsumers();
+  WorkStealingDeque_PopAndSteal();
+  WorkStealingDeque_WrapAndGrow();
+  WorkStealingDeque_ConcurrentSteals();
+  Atomic_Arithmetic();
+  Atomic_ConcurrentUpdates();
+  ShardedCounter_Take();
+}
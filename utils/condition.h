@@ -99,6 +99,17 @@ class Condition {
 
 #undef SIGNAL_IF
 
+  /// Sets '*p' equal to 'value' and signals a waiting thread, both while
+  /// holding the associated mutex. A thread that checks '*p' under the same
+  /// mutex can therefore never see the new value before the signal is sent.
+  template<typename T>
+  inline void SetAndSignal(T* p, const T& value) {
+    m_->Lock();
+    *p = value;
+    pthread_cond_signal(&cv_);
+    m_->Unlock();
+  }
+
   inline bool SignalIf(RTask<bool>* task) {
     bool r;
     task->SetResultPointer(&r);
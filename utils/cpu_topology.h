@@ -0,0 +1,228 @@
+
+#ifndef _DB_UTILS_CPU_TOPOLOGY_H_
+#define _DB_UTILS_CPU_TOPOLOGY_H_
+
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// How a group of threads is spread over the machine's CPUs.
+enum AffinityPolicy {
+  AFFINITY_NONE = 0,     // Threads are not pinned
+  AFFINITY_COMPACT = 1,  // Fill one core, package and node after the other
+  AFFINITY_SCATTER = 2,  // Round-robin over nodes and cores, SMT siblings last
+  AFFINITY_NUMA = 3,     // Each thread may run anywhere on one node
+};
+
+// Parses an affinity policy name ("none", "compact", "scatter" or "numa").
+// Returns false if 'name' is not one of them.
+inline bool ParseAffinityPolicy(const string& name, AffinityPolicy* policy) {
+  if (name == "none")
+    *policy = AFFINITY_NONE;
+  else if (name == "compact")
+    *policy = AFFINITY_COMPACT;
+  else if (name == "scatter")
+    *policy = AFFINITY_SCATTER;
+  else if (name == "numa")
+    *policy = AFFINITY_NUMA;
+  else
+    return false;
+  return true;
+}
+
+/// @class CpuTopology
+///
+/// The CPUs this process may run on, and how they map onto physical cores,
+/// packages and NUMA nodes, as reported by /sys/devices/system. Falls back to
+/// a flat topology (every CPU its own core, one node) if /sys is unavailable.
+class CpuTopology {
+ public:
+  CpuTopology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+      for (int i = 0; i < sysconf(_SC_NPROCESSORS_ONLN) && i < CPU_SETSIZE; i++)
+        CPU_SET(i, &allowed);
+    }
+
+    vector<int> online;
+    if (!ReadList("/sys/devices/system/cpu/online", &online)) {
+      for (int i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); i++)
+        online.push_back(i);
+    }
+
+    for (size_t i = 0; i < online.size(); i++) {
+      if (online[i] >= CPU_SETSIZE || !CPU_ISSET(online[i], &allowed))
+        continue;
+      Cpu cpu;
+      cpu.id_ = online[i];
+      cpu.core_ = ReadCpuValue(cpu.id_, "core_id", cpu.id_);
+      cpu.package_ = ReadCpuValue(cpu.id_, "physical_package_id", 0);
+      cpu.node_ = 0;
+      cpus_.push_back(cpu);
+    }
+
+    vector<int> nodes;
+    ReadList("/sys/devices/system/node/online", &nodes);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+               nodes[i]);
+      vector<int> node_cpus;
+      ReadList(path, &node_cpus);
+      for (size_t j = 0; j < cpus_.size(); j++) {
+        if (std::count(node_cpus.begin(), node_cpus.end(), cpus_[j].id_))
+          cpus_[j].node_ = nodes[i];
+      }
+    }
+
+    // A CPU's SMT rank is the number of lower-numbered CPUs on its core.
+    for (size_t i = 0; i < cpus_.size(); i++) {
+      cpus_[i].smt_rank_ = 0;
+      for (size_t j = 0; j < i; j++) {
+        if (cpus_[j].SameCore(cpus_[i]))
+          cpus_[i].smt_rank_++;
+      }
+    }
+  }
+
+  // Returns the number of CPUs this process may run on.
+  int CpuCount() const { return cpus_.size(); }
+
+  // Sets '*cpus' to the CPUs that thread 'index' of a group of threads placed
+  // with 'policy' may run on. CPU 'reserved' (e.g. a scheduler thread's) is
+  // left out, unless it is the only one. Returns false (leaving '*cpus' empty)
+  // if 'policy' is AFFINITY_NONE.
+  bool ThreadCpus(AffinityPolicy policy, int index, int reserved,
+                  cpu_set_t* cpus) const {
+    CPU_ZERO(cpus);
+    vector<Cpu> order;
+    for (size_t i = 0; i < cpus_.size(); i++) {
+      if (cpus_[i].id_ != reserved)
+        order.push_back(cpus_[i]);
+    }
+    if (order.empty())
+      order = cpus_;
+    if (policy == AFFINITY_NONE || order.empty())
+      return false;
+
+    if (policy == AFFINITY_NUMA) {
+      vector<int> nodes;
+      for (size_t i = 0; i < order.size(); i++) {
+        if (!std::count(nodes.begin(), nodes.end(), order[i].node_))
+          nodes.push_back(order[i].node_);
+      }
+      std::sort(nodes.begin(), nodes.end());
+      int node = nodes[index % nodes.size()];
+      for (size_t i = 0; i < order.size(); i++) {
+        if (order[i].node_ == node)
+          CPU_SET(order[i].id_, cpus);
+      }
+      return true;
+    }
+
+    std::sort(order.begin(), order.end(), CompactLess);
+    if (policy == AFFINITY_SCATTER) {
+      // Rank each core within its node, then deal CPUs out round-robin: over
+      // nodes first, then over the cores of each node, SMT siblings last.
+      for (size_t i = 0; i < order.size(); i++) {
+        order[i].core_rank_ = 0;
+        for (size_t j = 0; j < i; j++) {
+          if (order[j].node_ == order[i].node_ && order[j].smt_rank_ == 0 &&
+              !order[j].SameCore(order[i]))
+            order[i].core_rank_++;
+        }
+      }
+      std::stable_sort(order.begin(), order.end(), ScatterLess);
+    }
+    CPU_SET(order[index % order.size()].id_, cpus);
+    return true;
+  }
+
+ private:
+  struct Cpu {
+    int id_;
+    int core_;
+    int package_;
+    int node_;
+    int smt_rank_;
+    int core_rank_;
+
+    bool SameCore(const Cpu& other) const {
+      return core_ == other.core_ && package_ == other.package_ &&
+             node_ == other.node_;
+    }
+  };
+
+  static bool CompactLess(const Cpu& a, const Cpu& b) {
+    if (a.node_ != b.node_)
+      return a.node_ < b.node_;
+    if (a.package_ != b.package_)
+      return a.package_ < b.package_;
+    if (a.core_ != b.core_)
+      return a.core_ < b.core_;
+    return a.id_ < b.id_;
+  }
+
+  static bool ScatterLess(const Cpu& a, const Cpu& b) {
+    if (a.smt_rank_ != b.smt_rank_)
+      return a.smt_rank_ < b.smt_rank_;
+    if (a.core_rank_ != b.core_rank_)
+      return a.core_rank_ < b.core_rank_;
+    return a.node_ < b.node_;
+  }
+
+  // Reads the CPU or node list (e.g. "0-3,8,10-11") in file 'path' into
+  // '*list'. Returns false if the file could not be read.
+  static bool ReadList(const char* path, vector<int>* list) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+      return false;
+    char buffer[4096];
+    bool ok = fgets(buffer, sizeof(buffer), file) != NULL;
+    fclose(file);
+    if (!ok)
+      return false;
+
+    char* save;
+    for (char* range = strtok_r(buffer, ",\n", &save); range != NULL;
+         range = strtok_r(NULL, ",\n", &save)) {
+      int first, last;
+      int fields = sscanf(range, "%d-%d", &first, &last);
+      if (fields < 1)
+        continue;
+      if (fields == 1)
+        last = first;
+      for (int i = first; i <= last; i++)
+        list->push_back(i);
+    }
+    return true;
+  }
+
+  // Returns the integer in /sys/devices/system/cpu/cpu<cpu>/topology/<name>,
+  // or 'fallback' if it could not be read.
+  static int ReadCpuValue(int cpu, const char* name, int fallback) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+             cpu, name);
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+      return fallback;
+    int value;
+    if (fscanf(file, "%d", &value) != 1)
+      value = fallback;
+    fclose(file);
+    return value;
+  }
+
+  vector<Cpu> cpus_;
+};
+
+#endif  // _DB_UTILS_CPU_TOPOLOGY_H_
@@ -1,42 +1,87 @@
-
 #ifndef _DB_UTILS_DYNAMIC_THREAD_POOL_H_
 #define _DB_UTILS_DYNAMIC_THREAD_POOL_H_
 
 #include "pthread.h"
 #include "stdlib.h"
 #include "assert.h"
+#include "errno.h"
+#include "time.h"
+#include <algorithm>
 #include <queue>
 #include <string>
 #include <vector>
 #include "utils/atomic.h"
 #include "utils/task.h"
 #include "utils/mutex.h"
-#include "utils/condition.h"
 #include "utils/thread_pool.h"
 
-#include <iostream>
-using namespace std;
-
 using std::queue;
 using std::string;
 using std::vector;
 
+/// @class DynamicThreadPool
+///
+/// Elastic thread pool for long-running or blocking tasks. Each task is handed
+/// to an idle thread if there is one, or else to a newly started thread as
+/// long as the pool is below its cap. At the cap, tasks queue up until a
+/// thread frees up. Threads beyond the minimum exit once they have been idle
+/// for a while, so a burst of tasks does not leave its threads behind.
 class DynamicThreadPool : public ThreadPool {
  public:
-  // Default constructor creates a ThreadPool with no threads.
-  DynamicThreadPool() : thread_count_(0) {}
+  // Starts 'min_threads' threads right away, and never runs more than
+  // 'max_threads' at once. Threads beyond 'min_threads' exit after being idle
+  // for 'idle_timeout' seconds.
+  DynamicThreadPool(int min_threads = 0, int max_threads = 64,
+                    double idle_timeout = 1.0)
+      : min_threads_(min_threads), max_threads_(std::max(max_threads, 1)),
+        idle_timeout_(idle_timeout), live_threads_(0), thread_count_(0),
+        stopped_(false) {
+    pthread_cond_init(&exited_, NULL);
+    mutex_.Lock();
+    for (int i = 0; i < min_threads_ && StartThread(NULL); i++) {}
+    mutex_.Unlock();
+  }
+
+  ~DynamicThreadPool() {
+    Stop();
+    pthread_cond_destroy(&exited_);
+  }
 
+  // Runs all tasks already submitted, then stops all threads. Safe to call
+  // more than once.
+  void Stop() {
+    mutex_.Lock();
+    stopped_ = true;
+    // Busy threads exit once the queue is drained; idle ones are done now.
+    while (!idle_threads_.empty())
+      idle_threads_.back()->Kill();
+    while (live_threads_ > 0)
+      pthread_cond_wait(&exited_, &mutex_.mutex_);
+    mutex_.Unlock();
+  }
+
+  // Runs 'task' on a pool thread. If no thread is idle and none can be
+  // started (at the cap, or because pthread_create failed), 'task' waits for
+  // a busy thread to pick it up. If there is no thread at all, it runs on the
+  // calling thread instead.
   virtual void RunTask(Task* task) {
-    // Pop an available thread off the queue.
-    Thread* thread;
-    if (!available_threads_.Pop(&thread)) {
-      // Create a new available thread if there aren't any.
-      thread = new Thread(this);
-      ++thread_count_;
+    mutex_.Lock();
+    assert(!stopped_);
+    if (!idle_threads_.empty()) {
+      // Reuse the most recently idle thread, so that the others time out.
+      Thread* thread = idle_threads_.back();
+      idle_threads_.pop_back();
+      thread->RunTask(task);
+    } else if (live_threads_ < max_threads_ && StartThread(task)) {
+      // The new thread owns 'task'.
+    } else if (live_threads_ > 0) {
+      pending_.push(task);
+    } else {
+      mutex_.Unlock();
+      Thread::RunAndDelete(task);
+      return;
     }
-
-    // Run the task in the available thread we just grabbed.
-    thread->RunTask(task);
+    mutex_.Unlock();
   }
 
   virtual int ThreadCount() { return *thread_count_; }
@@ -44,19 +89,62 @@ class DynamicThreadPool : public ThreadPool {
  private:
   class Thread {
    public:
-    Thread(DynamicThreadPool* tp) : thread_pool_(tp), task_(NULL) {
-      pthread_create(&pthread_,
-                     NULL,
-                     StaticRunThread,
-                     reinterpret_cast<void*>(this));
+    // A thread that will run 'task' (if not NULL), then look for more work.
+    Thread(DynamicThreadPool* tp, Task* task)
+        : thread_pool_(tp), task_(task), idle_(false), killed_(false) {
+      pthread_cond_init(&cv_, NULL);
+    }
+
+    ~Thread() {
+      pthread_cond_destroy(&cv_);
     }
 
+    // Starts the thread, detached. Returns false if it could not be created,
+    // in which case the caller still owns this object and its task. Once it
+    // returns true, the thread deletes itself when it exits.
+    //
+    // Requires: the pool's mutex is held.
+    bool Start() {
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      int rc = pthread_create(&pthread_,
+                              &attr,
+                              StaticRunThread,
+                              reinterpret_cast<void*>(this));
+      pthread_attr_destroy(&attr);
+      return rc == 0;
+    }
+
+    // Runs 'task', then deletes it unless it is owned elsewhere.
+    static void RunAndDelete(Task* task) {
+      bool owned = task->DeleteAfterRun();
+      task->Run();
+      if (owned)
+        delete task;
+    }
+
+    // Hands 'task' to the thread.
+    //
+    // Requires: the pool's mutex is held, and the thread was idle and has
+    // already been taken off the pool's idle list.
     void RunTask(Task* task) {
-      assert(task_ == NULL);
+      assert(task_ == NULL && idle_);
       task_ = task;
+      idle_ = false;
+      pthread_cond_signal(&cv_);
+    }
 
-      // Signal thread to wake up (unless it has already executed the task).
-      cv_.SignalIfNonNull<Task*>(&task_);
+    // Makes the thread exit as soon as it is idle.
+    //
+    // Requires: the pool's mutex is held.
+    void Kill() {
+      killed_ = true;
+      if (idle_) {
+        thread_pool_->RemoveIdle(this);
+        idle_ = false;
+      }
+      pthread_cond_signal(&cv_);
     }
 
    private:
@@ -66,32 +154,127 @@ class DynamicThreadPool : public ThreadPool {
     };
 
     void RunThread() {
+      DynamicThreadPool* tp = thread_pool_;
+      struct timespec deadline;
+
+      tp->mutex_.Lock();
       while (true) {
-        // Run task_ any time it's not NULL.
-        cv_.WaitWhileEq<Task*>(NULL, &task_);
-        task_->Run();
-
-        // 
-        delete task_;
-        task_ = NULL;
-        thread_pool_->available_threads_.Push(this);
+        if (task_ == NULL && !tp->pending_.empty()) {
+          task_ = tp->pending_.front();
+          tp->pending_.pop();
+        }
+
+        if (task_ != NULL) {
+          Task* task = task_;
+          tp->mutex_.Unlock();
+          RunAndDelete(task);
+          tp->mutex_.Lock();
+          task_ = NULL;
+          continue;
+        }
+
+        if (killed_ || tp->stopped_)
+          break;
+
+        if (!idle_) {
+          idle_ = true;
+          tp->idle_threads_.push_back(this);
+          Deadline(tp->idle_timeout_, &deadline);
+        }
+
+        // Threads beyond the minimum give up after idling for too long.
+        if (tp->live_threads_ <= tp->min_threads_) {
+          pthread_cond_wait(&cv_, &tp->mutex_.mutex_);
+        } else if (pthread_cond_timedwait(&cv_, &tp->mutex_.mutex_,
+                                          &deadline) == ETIMEDOUT &&
+                   idle_ && tp->live_threads_ > tp->min_threads_) {
+          tp->RemoveIdle(this);
+          break;
+        }
       }
+
+      tp->live_threads_--;
+      --tp->thread_count_;
+      if (tp->live_threads_ == 0)
+        pthread_cond_broadcast(&tp->exited_);
+      tp->mutex_.Unlock();
+      delete this;
     }
 
-    void Kill() {
+    // Sets '*deadline' to 'timeout' seconds from now.
+    static void Deadline(double timeout, struct timespec* deadline) {
+      clock_gettime(CLOCK_REALTIME, deadline);
+      time_t secs = static_cast<time_t>(timeout);
+      deadline->tv_sec += secs;
+      deadline->tv_nsec += static_cast<long>((timeout - secs) * 1e9);
+      if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+      }
     }
 
     DynamicThreadPool* thread_pool_;
+
+    // Task to run next, if any.
     Task* task_;
+
+    // True while the thread is on the pool's idle list.
+    bool idle_;
+
+    // Set by Kill().
+    bool killed_;
+
     pthread_t pthread_;
-    Condition cv_;
+    pthread_cond_t cv_;
   };
 
-  // Available thread queue.
-  AtomicQueue<Thread*> available_threads_;
+  // Starts a new thread, running 'task' if it is not NULL. Returns false if
+  // the thread could not be created, leaving the pool as it was and 'task'
+  // with the caller.
+  //
+  // Requires: mutex_ is held.
+  bool StartThread(Task* task) {
+    Thread* thread = new Thread(this, task);
+    if (!thread->Start()) {
+      delete thread;
+      return false;
+    }
+    // The new thread blocks on mutex_ before it looks at the counts.
+    live_threads_++;
+    ++thread_count_;
+    return true;
+  }
+
+  // Takes 'thread' off the idle list.
+  //
+  // Requires: mutex_ is held, and 'thread' is on the idle list.
+  void RemoveIdle(Thread* thread) {
+    idle_threads_.erase(
+        std::find(idle_threads_.begin(), idle_threads_.end(), thread));
+  }
+
+  int min_threads_;
+  int max_threads_;
+  double idle_timeout_;
+
+  // Guards everything below except 'thread_count_'.
+  Mutex mutex_;
 
+  // Idle threads, the most recently idle last.
+  vector<Thread*> idle_threads_;
+
+  // Tasks submitted while all 'max_threads_' threads were busy.
+  queue<Task*> pending_;
+
+  // Number of running threads, and a copy that ThreadCount() can read without
+  // taking the mutex.
+  int live_threads_;
   Atomic<int> thread_count_;
+
+  // Signalled when the last thread exits.
+  pthread_cond_t exited_;
+
+  bool stopped_;
 };
 
 #endif  // _DB_UTILS_DYNAMIC_THREAD_POOL_H_
-
@@ -0,0 +1,133 @@
+
+#include "utils/dynamic_thread_pool.h"
+
+#include <unistd.h>
+
+#include "utils/testing.h"
+
+// Counts how often it is run. If 'gate_' is not NULL, it first waits until
+// '*gate_' is set, and counts the runs that have started in 'started_'.
+class CountTask : public Task {
+ public:
+  CountTask(std::atomic<int>* count, std::atomic<bool>* gate = NULL,
+            std::atomic<int>* started = NULL)
+      : count_(count), gate_(gate), started_(started) {}
+
+  virtual void Run() {
+    if (started_ != NULL)
+      (*started_)++;
+    while (gate_ != NULL && !gate_->load())
+      usleep(1000);
+    (*count_)++;
+  }
+
+ private:
+  std::atomic<int>* count_;
+  std::atomic<bool>* gate_;
+  std::atomic<int>* started_;
+};
+
+// Sleeps until '*count' reaches 'n', or for at most ten seconds.
+static void WaitForCount(std::atomic<int>* count, int n) {
+  for (int i = 0; i < 10000 && count->load() < n; i++)
+    usleep(1000);
+}
+
+// Sleeps until 'pool' has 'n' threads, or for at most ten seconds.
+static void WaitForThreads(DynamicThreadPool* pool, int n) {
+  for (int i = 0; i < 10000 && pool->ThreadCount() != n; i++)
+    usleep(1000);
+}
+
+TEST(DynamicThreadPool_RunTask) {
+  DynamicThreadPool pool(2, 8);
+  EXPECT_EQ(2, pool.ThreadCount());
+
+  std::atomic<int> count(0);
+  for (int i = 0; i < 1000; i++)
+    pool.RunTask(new CountTask(&count));
+  WaitForCount(&count, 1000);
+  EXPECT_EQ(1000, count.load());
+  EXPECT_TRUE(pool.ThreadCount() <= 8);
+
+  END;
+}
+
+TEST(DynamicThreadPool_Cap) {
+  DynamicThreadPool pool(0, 4);
+  EXPECT_EQ(0, pool.ThreadCount());
+
+  // Blocking tasks get a thread each up to the cap, and the rest wait.
+  std::atomic<bool> gate(false);
+  std::atomic<int> started(0);
+  std::atomic<int> count(0);
+  for (int i = 0; i < 10; i++)
+    pool.RunTask(new CountTask(&count, &gate, &started));
+  WaitForCount(&started, 4);
+  usleep(50000);
+  EXPECT_EQ(4, started.load());
+  EXPECT_EQ(4, pool.ThreadCount());
+  EXPECT_EQ(0, count.load());
+
+  // Once the gate opens, the waiting tasks run on the same threads.
+  gate = true;
+  WaitForCount(&count, 10);
+  EXPECT_EQ(10, count.load());
+  EXPECT_EQ(4, pool.ThreadCount());
+
+  END;
+}
+
+TEST(DynamicThreadPool_IdleTimeout) {
+  DynamicThreadPool pool(1, 4, 0.05);
+  std::atomic<bool> gate(false);
+  std::atomic<int> started(0);
+  std::atomic<int> count(0);
+  for (int i = 0; i < 4; i++)
+    pool.RunTask(new CountTask(&count, &gate, &started));
+  WaitForCount(&started, 4);
+  EXPECT_EQ(4, pool.ThreadCount());
+
+  // The threads beyond the minimum exit after idling for the timeout.
+  gate = true;
+  WaitForCount(&count, 4);
+  WaitForThreads(&pool, 1);
+  EXPECT_EQ(1, pool.ThreadCount());
+
+  // The pool grows again when it needs to.
+  gate = false;
+  started = 0;
+  for (int i = 0; i < 3; i++)
+    pool.RunTask(new CountTask(&count, &gate, &started));
+  WaitForCount(&started, 3);
+  EXPECT_EQ(3, pool.ThreadCount());
+  gate = true;
+
+  END;
+}
+
+TEST(DynamicThreadPool_StopDrainsTasks) {
+  std::atomic<bool> gate(false);
+  std::atomic<int> started(0);
+  std::atomic<int> count(0);
+  DynamicThreadPool pool(0, 2);
+  for (int i = 0; i < 100; i++)
+    pool.RunTask(new CountTask(&count, &gate, &started));
+  WaitForCount(&started, 2);
+  gate = true;
+  pool.Stop();
+  EXPECT_EQ(100, count.load());
+  EXPECT_EQ(0, pool.ThreadCount());
+
+  // Stopping again is harmless.
+  pool.Stop();
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  DynamicThreadPool_RunTask();
+  DynamicThreadPool_Cap();
+  DynamicThreadPool_IdleTimeout();
+  DynamicThreadPool_StopDrainsTasks();
+}
@@ -0,0 +1,208 @@
+#ifndef _DB_UTILS_FLAT_MAP_H_
+#define _DB_UTILS_FLAT_MAP_H_
+
+#include <stddef.h>
+#include <algorithm>
+#include <utility>
+
+/// @class SmallVector<T, N>
+/// @brief Vector that stores up to N elements inline.
+///
+/// Only grows onto the heap once it holds more than N elements. Clearing a
+/// SmallVector keeps its capacity.
+///
+/// Requires: T is default constructible and copyable.
+template<typename T, int N>
+class SmallVector {
+ public:
+  SmallVector() : data_(inline_), size_(0), capacity_(N) {}
+  SmallVector(const SmallVector& other)
+      : data_(inline_), size_(0), capacity_(N) {
+    *this = other;
+  }
+  ~SmallVector() {
+    if (data_ != inline_)
+      delete[] data_;
+  }
+
+  SmallVector& operator=(const SmallVector& other) {
+    if (this != &other) {
+      Reserve(other.size_);
+      std::copy(other.data_, other.data_ + other.size_, data_);
+      size_ = other.size_;
+    }
+    return *this;
+  }
+
+  T* begin() { return data_; }
+  T* end() { return data_ + size_; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  void clear() { size_ = 0; }
+
+  T& operator[](size_t i) { return data_[i]; }
+  const T& operator[](size_t i) const { return data_[i]; }
+
+  void push_back(const T& value) {
+    Reserve(size_ + 1);
+    data_[size_++] = value;
+  }
+
+  // Inserts 'value' before 'pos' and returns its new position.
+  T* insert(T* pos, const T& value) {
+    size_t i = pos - data_;
+    Reserve(size_ + 1);
+    std::copy_backward(data_ + i, data_ + size_, data_ + size_ + 1);
+    data_[i] = value;
+    size_++;
+    return data_ + i;
+  }
+
+  // Removes the element at 'pos'.
+  void erase(T* pos) {
+    std::copy(pos + 1, data_ + size_, pos);
+    size_--;
+  }
+
+ private:
+  void Reserve(size_t n) {
+    if (n <= capacity_)
+      return;
+    size_t capacity = std::max(n, 2 * capacity_);
+    T* data = new T[capacity];
+    std::copy(data_, data_ + size_, data);
+    if (data_ != inline_)
+      delete[] data_;
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+  T inline_[N];
+  T* data_;
+  size_t size_;
+  size_t capacity_;
+};
+
+/// @class FlatSet<K, N>
+/// @brief Ordered set stored as a sorted SmallVector<K, N>.
+///
+/// Supports the subset of the std::set interface that is needed for small
+/// key sets. Lookups are binary searches over contiguous memory, and sets of
+/// up to N keys never allocate. Inserting is linear in the size of the set.
+template<typename K, int N>
+class FlatSet {
+ public:
+  typedef const K* iterator;
+  typedef const K* const_iterator;
+
+  iterator begin() const { return keys_.begin(); }
+  iterator end() const { return keys_.end(); }
+  size_t size() const { return keys_.size(); }
+  bool empty() const { return keys_.empty(); }
+  void clear() { keys_.clear(); }
+
+  iterator find(const K& key) const {
+    iterator it = std::lower_bound(begin(), end(), key);
+    return (it != end() && *it == key) ? it : end();
+  }
+
+  size_t count(const K& key) const { return find(key) != end(); }
+
+  // Inserts 'key' if it is not in the set yet. Returns true if it was
+  // inserted.
+  bool insert(const K& key) {
+    // Keys are often inserted in order.
+    if (keys_.empty() || *(keys_.end() - 1) < key) {
+      keys_.push_back(key);
+      return true;
+    }
+    K* it = std::lower_bound(keys_.begin(), keys_.end(), key);
+    if (*it == key)
+      return false;
+    keys_.insert(it, key);
+    return true;
+  }
+
+  // Replaces the contents of the set with the keys in [first, last).
+  template<typename InputIterator>
+  void assign(InputIterator first, InputIterator last) {
+    clear();
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+ private:
+  SmallVector<K, N> keys_;
+};
+
+/// @class FlatMap<K, V, N>
+/// @brief Ordered map stored as a sorted SmallVector<std::pair<K, V>, N>.
+///
+/// Supports the subset of the std::map interface that is needed for small
+/// per-key buffers, with the same cost model as FlatSet. Iterators (and
+/// references returned by operator[]) are invalidated by inserting or
+/// erasing elements.
+template<typename K, typename V, int N>
+class FlatMap {
+ public:
+  typedef std::pair<K, V> value_type;
+  typedef value_type* iterator;
+  typedef const value_type* const_iterator;
+
+  iterator begin() { return entries_.begin(); }
+  iterator end() { return entries_.end(); }
+  const_iterator begin() const { return entries_.begin(); }
+  const_iterator end() const { return entries_.end(); }
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+  void clear() { entries_.clear(); }
+
+  iterator find(const K& key) {
+    iterator it = LowerBound(key);
+    return (it != end() && it->first == key) ? it : end();
+  }
+  const_iterator find(const K& key) const {
+    return const_cast<FlatMap*>(this)->find(key);
+  }
+
+  size_t count(const K& key) const { return find(key) != end(); }
+
+  // Returns the value mapped to 'key', inserting a default-constructed value
+  // first if there is none.
+  V& operator[](const K& key) {
+    if (entries_.empty() || (entries_.end() - 1)->first < key) {
+      entries_.push_back(value_type(key, V()));
+      return (entries_.end() - 1)->second;
+    }
+    iterator it = LowerBound(key);
+    if (it->first != key)
+      it = entries_.insert(it, value_type(key, V()));
+    return it->second;
+  }
+
+  // Removes the entry for 'key', if any. Returns the number of entries
+  // removed.
+  size_t erase(const K& key) {
+    iterator it = find(key);
+    if (it == end())
+      return 0;
+    entries_.erase(it);
+    return 1;
+  }
+
+ private:
+  static bool KeyLess(const value_type& entry, const K& key) {
+    return entry.first < key;
+  }
+
+  iterator LowerBound(const K& key) {
+    return std::lower_bound(begin(), end(), key, KeyLess);
+  }
+
+  SmallVector<value_type, N> entries_;
+};
+
+#endif  // _DB_UTILS_FLAT_MAP_H_
@@ -4,6 +4,8 @@
 
 #include <pthread.h>
 
+template<typename T> class AtomicQueue;
+
 /// @class Mutex
 ///
 /// A simple mutex, actually a thin wrapper around pthread's mutex
@@ -35,6 +37,8 @@ class Mutex {
 
  private:
   friend class Condition;
+  template<typename T> friend class AtomicQueue;
+  friend class DynamicThreadPool;
 
   // Actual pthread mutex wrapped by Mutex class.
   pthread_mutex_t mutex_;
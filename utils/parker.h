@@ -0,0 +1,67 @@
+
+#ifndef _DB_UTILS_PARKER_H_
+#define _DB_UTILS_PARKER_H_
+
+#include <atomic>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// Hints to the CPU that the calling thread is busy-waiting, so that it backs
+/// off the memory system and yields pipeline resources to its sibling
+/// hyperthread.
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#else
+  asm volatile("" ::: "memory");
+#endif
+}
+
+/// @class Parker
+///
+/// Lets one thread sleep until another thread wakes it up, built directly on a
+/// Linux futex so that neither side takes a lock. Only the owning thread may
+/// call Park(); any thread may call Unpark(). An Unpark() that comes before
+/// the Park() is not lost: the Park() then returns immediately. Park() may
+/// also return spuriously, so callers re-check their condition in a loop.
+class Parker {
+ public:
+  Parker() : state_(EMPTY) {}
+
+  // Sleeps until Unpark() is called, unless it already has been since the
+  // last Park() returned.
+  void Park() {
+    // EMPTY -> PARKED, or NOTIFIED -> EMPTY.
+    if (state_.fetch_sub(1, std::memory_order_acquire) == NOTIFIED)
+      return;
+    while (state_.load(std::memory_order_acquire) == PARKED)
+      Futex(FUTEX_WAIT_PRIVATE, PARKED);
+    state_.store(EMPTY, std::memory_order_relaxed);
+  }
+
+  // Wakes up the owning thread, or makes its next Park() return immediately.
+  void Unpark() {
+    if (state_.exchange(NOTIFIED, std::memory_order_release) == PARKED)
+      Futex(FUTEX_WAKE_PRIVATE, 1);
+  }
+
+ private:
+  enum State {
+    PARKED = -1,
+    EMPTY = 0,
+    NOTIFIED = 1,
+  };
+
+  void Futex(int op, int value) {
+    syscall(SYS_futex, reinterpret_cast<int*>(&state_), op, value, NULL, NULL,
+            0);
+  }
+
+  std::atomic<int> state_;
+};
+
+#endif  // _DB_UTILS_PARKER_H_
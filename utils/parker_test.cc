@@ -0,0 +1,104 @@
+
+#include "utils/parker.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include "utils/testing.h"
+
+// Returns the current time in seconds.
+static double Now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Unparks 'parker_' after 'delay_' seconds.
+struct DelayedUnpark {
+  Parker* parker_;
+  double delay_;
+};
+
+static void* RunDelayedUnpark(void* arg) {
+  DelayedUnpark* unpark = reinterpret_cast<DelayedUnpark*>(arg);
+  usleep(static_cast<useconds_t>(unpark->delay_ * 1e6));
+  unpark->parker_->Unpark();
+  return NULL;
+}
+
+TEST(Parker_UnparkBeforePark) {
+  Parker parker;
+
+  // An earlier Unpark() is not lost.
+  parker.Unpark();
+  double start = Now();
+  parker.Park();
+  EXPECT_TRUE(Now() - start < 1);
+
+  // Unparks do not accumulate: after two of them, one Park() consumes both,
+  // and the next one sleeps until the next Unpark().
+  parker.Unpark();
+  parker.Unpark();
+  parker.Park();
+  DelayedUnpark unpark = {&parker, 0.05};
+  pthread_t thread;
+  pthread_create(&thread, NULL, RunDelayedUnpark, &unpark);
+  start = Now();
+  parker.Park();
+  EXPECT_TRUE(Now() - start >= 0.04);
+  pthread_join(thread, NULL);
+
+  END;
+}
+
+// Two threads take turns incrementing 'value_'. Each waits for its turn by
+// parking, and hands the turn over by unparking the other thread.
+struct PingPong {
+  Parker parkers_[2];
+  std::atomic<int> turn_;
+  int value_;
+  bool ok_[2];
+};
+
+static const int kRounds = 10000;
+
+static void PlayPingPong(PingPong* game, int me) {
+  game->ok_[me] = true;
+  for (int i = 0; i < kRounds; i++) {
+    // Park() may return spuriously, so re-check the turn.
+    while (game->turn_.load(std::memory_order_acquire) != me)
+      game->parkers_[me].Park();
+    if (game->value_ != 2 * i + me)
+      game->ok_[me] = false;
+    game->value_++;
+    game->turn_.store(1 - me, std::memory_order_release);
+    game->parkers_[1 - me].Unpark();
+  }
+}
+
+static void* RunPong(void* arg) {
+  PlayPingPong(reinterpret_cast<PingPong*>(arg), 1);
+  return NULL;
+}
+
+TEST(Parker_PingPong) {
+  PingPong game;
+  game.turn_ = 0;
+  game.value_ = 0;
+  pthread_t thread;
+  pthread_create(&thread, NULL, RunPong, &game);
+  PlayPingPong(&game, 0);
+  pthread_join(thread, NULL);
+
+  // No wakeup was lost (or the game would hang), and the turns alternated.
+  EXPECT_TRUE(game.ok_[0]);
+  EXPECT_TRUE(game.ok_[1]);
+  EXPECT_EQ(2 * kRounds, game.value_);
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  Parker_UnparkBeforePark();
+  Parker_PingPong();
+}
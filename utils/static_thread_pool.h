@@ -1,3 +1,6 @@
+/// @file
+/// @author Alexander Thomson <thomson@cs.yale.edu>
+// Modified by: Kun Ren (kun.ren@yale.edu)
 
 #ifndef _DB_UTILS_STATIC_THREAD_POOL_H_
 #define _DB_UTILS_STATIC_THREAD_POOL_H_
@@ -8,26 +11,52 @@
 #include <queue>
 #include <string>
 #include <vector>
-#include <utility>
 #include "utils/atomic.h"
+#include "utils/cpu_topology.h"
+#include "utils/parker.h"
 #include "utils/thread_pool.h"
 
 using std::queue;
 using std::string;
 using std::vector;
-using std::pair;
 
-//
+/// @class StaticThreadPool
+///
+/// Fixed-size work-stealing thread pool. Each thread owns a Chase-Lev deque:
+/// tasks submitted by a pool thread go onto the bottom of its own deque, and
+/// tasks submitted from outside the pool go into a shared injection queue.
+/// A thread that runs out of local work takes the next injected task, or else
+/// steals the oldest task from a randomly chosen peer, so one long task can
+/// never strand the tasks queued behind it.
+///
+/// A thread that finds no work spins briefly, then parks on a futex.
+/// Submitting a task unparks exactly one parked thread, if there is one.
 class StaticThreadPool : public ThreadPool {
  public:
-  StaticThreadPool(int nthreads)
-      : thread_count_(nthreads), stopped_(false) {
-    Start();
+  // Starts 'nthreads' threads, pinned to CPUs according to 'policy'. With a
+  // pinning policy, CPU 'reserved_cpu' (if non-negative) is left alone unless
+  // it is the only one available.
+  StaticThreadPool(int nthreads, AffinityPolicy policy = AFFINITY_NONE,
+                   int reserved_cpu = -1)
+      : thread_count_(nthreads), idle_count_(0), stopped_(false) {
+    Start(policy, reserved_cpu);
   }
 
 
   ~StaticThreadPool() {
+    Stop();
+    delete[] workers_;
+  }
+
+  // Stops all threads once they have drained the tasks already queued in the
+  // pool. Safe to call more than once.
+  void Stop() {
+    if (stopped_)
+      return;
     stopped_ = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int i = 0; i < thread_count_; i++)
+      Wake(&workers_[i]);
     for (int i = 0; i < thread_count_; i++)
       pthread_join(threads_[i], NULL);
   }
@@ -36,176 +65,182 @@ class StaticThreadPool : public ThreadPool {
 
   virtual void RunTask(Task* task) {
     assert(!stopped_);
-    while (!queues_[rand() % thread_count_].PushNonBlocking(task)) {}
+    Worker* worker = CurrentWorker();
+    if (worker != NULL && worker->pool_ == this)
+      worker->deque_.Push(task);
+    else
+      injected_.Push(task);
+    WakeOne();
+  }
+
+  // Runs 'task' on the pool thread with index 'thread'. Useful for
+  // long-running tasks (e.g. worker loops) that should each own a thread.
+  // Such tasks are never stolen.
+  void RunTaskOn(int thread, Task* task) {
+    assert(!stopped_);
+    Worker* worker = &workers_[thread % thread_count_];
+    worker->pinned_.Push(task);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Wake(worker);
   }
 
   virtual int ThreadCount() { return thread_count_; }
 
  private:
-  void Start() {
+  // Per-thread state.
+  struct Worker {
+    StaticThreadPool* pool_;
+    int id_;
+
+    // Seed for picking steal victims with rand_r.
+    unsigned int seed_;
+
+    // Tasks submitted with RunTaskOn.
+    AtomicQueue<Task*> pinned_;
+
+    // Tasks submitted by this thread. Popped LIFO by this thread, stolen FIFO
+    // by the others.
+    WorkStealingDeque<Task*> deque_;
+
+    // True while the thread is parked, or about to park. Cleared by whoever
+    // wakes it up.
+    std::atomic<bool> idle_;
+    Parker parker_;
+  };
+
+  // Number of rounds an idle thread spins looking for work before it parks,
+  // and the number of pause instructions per round.
+  static const int kSpinRounds = 64;
+  static const int kPausesPerRound = 32;
+
+  void Start(AffinityPolicy policy, int reserved_cpu) {
     threads_.resize(thread_count_);
-    queues_.resize(thread_count_);
-    
-    // Pin all threads in the thread pool to CPU Core 0 ~ 6
-    cpu_set_t cpuset;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    CPU_ZERO(&cpuset);
-    for (int i = 0; i < 7;i++) {
-      CPU_SET(i, &cpuset); 
-    }
-         
-    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+    workers_ = new Worker[thread_count_];
 
+    CpuTopology topology;
     for (int i = 0; i < thread_count_; i++) {
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      cpu_set_t cpuset;
+      if (topology.ThreadCpus(policy, i, reserved_cpu, &cpuset))
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+
+      workers_[i].pool_ = this;
+      workers_[i].id_ = i;
+      workers_[i].seed_ = i + 1;
+      workers_[i].idle_.store(false, std::memory_order_relaxed);
       pthread_create(&threads_[i],
                      &attr,
                      RunThread,
-                     reinterpret_cast<void*>(new pair<int, StaticThreadPool*>(i, this)));
+                     reinterpret_cast<void*>(&workers_[i]));
+      pthread_attr_destroy(&attr);
     }
   }
 
-  // Function executed by each pthread.
-  static void* RunThread(void* arg) {
-    int queue_id = reinterpret_cast<pair<int, StaticThreadPool*>*>(arg)->first;
-    StaticThreadPool* tp = reinterpret_cast<pair<int, StaticThreadPool*>*>(arg)->second;
-    
-    Task* task;
-    int sleep_duration = 1;  // in microseconds
-    while (true) {
-      if (tp->queues_[queue_id].PopNonBlocking(&task)) {
-        task->Run();
-        delete task;
-        // Reset backoff.
-        sleep_duration = 1;
-      } else {
-        usleep(sleep_duration);
-        // Back off exponentially.
-        if (sleep_duration < 32)
-          sleep_duration *= 2;
-      }
-
-      if (tp->stopped_) {
-        // Go through ALL queues looking for a remaining task.
-        while (tp->queues_[queue_id].Pop(&task)) {
-            task->Run();
-            delete task;
-        }
-
-        break;
-      }
-    }
-    return NULL;
+  // Returns the calling thread's Worker, or NULL if it is not a pool thread.
+  static Worker*& CurrentWorker() {
+    static __thread Worker* worker = NULL;
+    return worker;
   }
 
-  int thread_count_;
-  vector<pthread_t> threads_;
-
-  // Task queues.
-  vector<AtomicQueue<Task*> > queues_;
-
-  bool stopped_;
-};
-
-#endif  // _DB_UTILS_STATIC_THREAD_POOL_H_
-/// @file
-/// @author Alexander Thomson <thomson@cs.yale.edu>
-// Modified by: Kun Ren (kun.ren@yale.edu)
-
-#ifndef _DB_UTILS_STATIC_THREAD_POOL_H_
-#define _DB_UTILS_STATIC_THREAD_POOL_H_
-
-#include "pthread.h"
-#include "stdlib.h"
-#include "assert.h"
-#include <queue>
-#include <string>
-#include <vector>
-#include <utility>
-#include "utils/atomic.h"
-#include "utils/thread_pool.h"
-
-using std::queue;
-using std::string;
-using std::vector;
-using std::pair;
-
-//
-class StaticThreadPool : public ThreadPool {
- public:
-  StaticThreadPool(int nthreads)
-      : thread_count_(nthreads), stopped_(false) {
-    Start();
+  // Runs 'task', then deletes it unless it is owned elsewhere.
+  static void RunAndDelete(Task* task) {
+    bool owned = task->DeleteAfterRun();
+    task->Run();
+    if (owned)
+      delete task;
   }
 
+  // Sets '*task' to the next task for 'worker' to run and returns true, or
+  // returns false if no work was found anywhere in the pool. Pinned tasks come
+  // first, then the worker's own newest task, then the oldest injected task,
+  // then a task stolen from the first non-empty peer after a random one.
+  bool NextTask(Worker* worker, Task** task) {
+    if (worker->pinned_.Pop(task) || worker->deque_.Pop(task) ||
+        injected_.Pop(task))
+      return true;
 
-  ~StaticThreadPool() {
-    stopped_ = true;
-    for (int i = 0; i < thread_count_; i++)
-      pthread_join(threads_[i], NULL);
+    int start = rand_r(&worker->seed_) % thread_count_;
+    for (int i = 0; i < thread_count_; i++) {
+      Worker* victim = &workers_[(start + i) % thread_count_];
+      if (victim != worker && victim->deque_.Steal(task))
+        return true;
+    }
+    return false;
   }
 
-  bool Active() { return !stopped_; }
-
-  virtual void RunTask(Task* task) {
-    assert(!stopped_);
-    while (!queues_[rand() % thread_count_].PushNonBlocking(task)) {}
+  // Wakes up 'worker' if it is parked. Returns true if it was.
+  //
+  // Requires: the work meant for 'worker' was published, followed by a seq_cst
+  // fence, so that it cannot be missed by the re-check in Idle().
+  bool Wake(Worker* worker) {
+    if (!worker->idle_.load(std::memory_order_relaxed) ||
+        !worker->idle_.exchange(false, std::memory_order_acq_rel))
+      return false;
+    idle_count_.fetch_sub(1, std::memory_order_relaxed);
+    worker->parker_.Unpark();
+    return true;
   }
 
-  virtual int ThreadCount() { return thread_count_; }
-
- private:
-  void Start() {
-    threads_.resize(thread_count_);
-    queues_.resize(thread_count_);
-    
-    // Pin all threads in the thread pool to CPU Core 0 ~ 6
-    cpu_set_t cpuset;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    CPU_ZERO(&cpuset);
-    for (int i = 0; i < 19;i++) {
-      CPU_SET(i, &cpuset); 
+  // Wakes up one parked thread, if any, to pick up a newly submitted task.
+  void WakeOne() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Acquire, so that the idle_ flags of the counted threads are visible.
+    if (idle_count_.load(std::memory_order_acquire) == 0)
+      return;
+    for (int i = 0; i < thread_count_; i++) {
+      if (Wake(&workers_[i]))
+        return;
     }
-         
-    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+  }
 
-    for (int i = 0; i < thread_count_; i++) {
-      pthread_create(&threads_[i],
-                     &attr,
-                     RunThread,
-                     reinterpret_cast<void*>(new pair<int, StaticThreadPool*>(i, this)));
+  // Called when 'worker' found no work. Spins for a while, then parks until
+  // woken up by a submission or by Stop(). Returns true with '*task' set if
+  // work turned up, and false otherwise (in which case the caller looks
+  // again, or exits if the pool was stopped).
+  bool Idle(Worker* worker, Task** task) {
+    for (int round = 0; round < kSpinRounds; round++) {
+      for (int i = 0; i < kPausesPerRound; i++)
+        CpuRelax();
+      if (NextTask(worker, task))
+        return true;
+      if (stopped_)
+        return false;
     }
+
+    // Announce that we are about to park, then look once more. Submitters
+    // publish their task before checking for parked threads, so either we
+    // see the task here or they see us and wake us up.
+    worker->idle_.store(true, std::memory_order_relaxed);
+    idle_count_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool found = NextTask(worker, task);
+    if (!found && !stopped_)
+      worker->parker_.Park();
+    if (worker->idle_.exchange(false, std::memory_order_acq_rel))
+      idle_count_.fetch_sub(1, std::memory_order_relaxed);
+    return found;
   }
 
   // Function executed by each pthread.
   static void* RunThread(void* arg) {
-    int queue_id = reinterpret_cast<pair<int, StaticThreadPool*>*>(arg)->first;
-    StaticThreadPool* tp = reinterpret_cast<pair<int, StaticThreadPool*>*>(arg)->second;
-    
+    Worker* worker = reinterpret_cast<Worker*>(arg);
+    StaticThreadPool* tp = worker->pool_;
+    CurrentWorker() = worker;
+
     Task* task;
-    int sleep_duration = 1;  // in microseconds
     while (true) {
-      if (tp->queues_[queue_id].PopNonBlocking(&task)) {
-        task->Run();
-        delete task;
-        // Reset backoff.
-        sleep_duration = 1;
-      } else {
-        usleep(sleep_duration);
-        // Back off exponentially.
-        if (sleep_duration < 32)
-          sleep_duration *= 2;
-      }
-
-      if (tp->stopped_) {
-        // Go through ALL queues looking for a remaining task.
-        while (tp->queues_[queue_id].Pop(&task)) {
-            task->Run();
-            delete task;
-        }
-
-        break;
+      if (tp->NextTask(worker, &task) || tp->Idle(worker, &task)) {
+        RunAndDelete(task);
+      } else if (tp->stopped_) {
+        // Look once more now that the stop is visible: a task submitted just
+        // before Stop() may have arrived after the last look (e.g. while this
+        // thread was waking up). If every queue this thread could take work
+        // from is still empty, it is done. Tasks that other threads are still
+        // spawning go onto their own deques, which they drain themselves.
+        if (!tp->NextTask(worker, &task))
+          break;
+        RunAndDelete(task);
       }
     }
     return NULL;
@@ -214,11 +249,16 @@ class StaticThreadPool : public ThreadPool {
   int thread_count_;
   vector<pthread_t> threads_;
 
-  // Task queues.
-  vector<AtomicQueue<Task*> > queues_;
+  // Per-thread state, one per thread.
+  Worker* workers_;
+
+  // Tasks submitted from outside the pool.
+  AtomicQueue<Task*> injected_;
 
-  bool stopped_;
+  // Number of threads whose idle_ flag is set.
+  std::atomic<int> idle_count_;
+
+  std::atomic<bool> stopped_;
 };
 
 #endif  // _DB_UTILS_STATIC_THREAD_POOL_H_
-
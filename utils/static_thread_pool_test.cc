@@ -0,0 +1,130 @@
+
+#include "utils/static_thread_pool.h"
+
+#include <unistd.h>
+#include <vector>
+
+#include "utils/testing.h"
+
+using std::vector;
+
+// Counts how often it is run. If 'children_' is positive, it first submits
+// that many children (each with one child fewer) to 'pool_' from inside the
+// pool, so that they land on the running thread's own deque.
+class CountTask : public Task {
+ public:
+  CountTask(std::atomic<int>* count, StaticThreadPool* pool = NULL,
+            int children = 0)
+      : count_(count), pool_(pool), children_(children) {}
+
+  virtual void Run() {
+    for (int i = 0; i < children_; i++)
+      pool_->RunTask(new CountTask(count_, pool_, children_ - 1));
+    (*count_)++;
+  }
+
+ private:
+  std::atomic<int>* count_;
+  StaticThreadPool* pool_;
+  int children_;
+};
+
+// Records the thread it ran on.
+class ThreadTask : public Task {
+ public:
+  ThreadTask(pthread_t* thread, std::atomic<int>* count)
+      : thread_(thread), count_(count) {}
+
+  virtual void Run() {
+    *thread_ = pthread_self();
+    (*count_)++;
+  }
+
+ private:
+  pthread_t* thread_;
+  std::atomic<int>* count_;
+};
+
+// Sleeps until '*count' reaches 'n', or for at most ten seconds.
+static void WaitForCount(std::atomic<int>* count, int n) {
+  for (int i = 0; i < 10000 && count->load() < n; i++)
+    usleep(1000);
+}
+
+TEST(StaticThreadPool_RunTask) {
+  StaticThreadPool pool(4);
+  EXPECT_EQ(4, pool.ThreadCount());
+  EXPECT_TRUE(pool.Active());
+
+  // Tasks submitted from outside the pool.
+  std::atomic<int> count(0);
+  for (int i = 0; i < 1000; i++)
+    pool.RunTask(new CountTask(&count));
+  WaitForCount(&count, 1000);
+  EXPECT_EQ(1000, count.load());
+
+  // Tasks that spawn more tasks from inside the pool: 1 + 4 + 4*3 + 4*3*2 +
+  // 4*3*2*1 tasks per root.
+  count = 0;
+  for (int i = 0; i < 10; i++)
+    pool.RunTask(new CountTask(&count, &pool, 4));
+  WaitForCount(&count, 650);
+  EXPECT_EQ(650, count.load());
+
+  END;
+}
+
+TEST(StaticThreadPool_RunTaskOn) {
+  StaticThreadPool pool(4);
+  const int kTasks = 100;
+  pthread_t threads[4][kTasks];
+  std::atomic<int> count(0);
+  for (int i = 0; i < kTasks; i++) {
+    for (int t = 0; t < 4; t++)
+      pool.RunTaskOn(t, new ThreadTask(&threads[t][i], &count));
+  }
+  WaitForCount(&count, 4 * kTasks);
+  EXPECT_EQ(4 * kTasks, count.load());
+
+  // Every task pinned to a thread ran on it, and no two threads are the same.
+  bool same = true;
+  for (int t = 0; t < 4; t++) {
+    for (int i = 1; i < kTasks; i++)
+      same = same && pthread_equal(threads[t][0], threads[t][i]);
+  }
+  EXPECT_TRUE(same);
+  bool distinct = true;
+  for (int t = 0; t < 4; t++) {
+    for (int u = t + 1; u < 4; u++)
+      distinct = distinct && !pthread_equal(threads[t][0], threads[u][0]);
+  }
+  EXPECT_TRUE(distinct);
+
+  END;
+}
+
+TEST(StaticThreadPool_StopDrainsTasks) {
+  std::atomic<int> count(0);
+  StaticThreadPool pool(2);
+
+  // Let the threads park first, so that the submissions have to wake them.
+  usleep(50000);
+  for (int i = 0; i < 1000; i++)
+    pool.RunTask(new CountTask(&count));
+  for (int i = 0; i < 100; i++)
+    pool.RunTaskOn(i, new CountTask(&count));
+  pool.Stop();
+  EXPECT_EQ(1100, count.load());
+  EXPECT_FALSE(pool.Active());
+
+  // Stopping again is harmless.
+  pool.Stop();
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  StaticThreadPool_RunTask();
+  StaticThreadPool_RunTaskOn();
+  StaticThreadPool_StopDrainsTasks();
+}
@@ -28,6 +28,11 @@ class Task {
 
   // Run the task.
   virtual void Run() = 0;
+
+  // Returns true if the thread pool that runs the task should delete it once
+  // it has run. Tasks that are embedded in (and reused by) other objects
+  // return false, and must not be touched by the pool after Run() starts.
+  virtual bool DeleteAfterRun() { return true; }
 };
 
 /// @class RTask<R>